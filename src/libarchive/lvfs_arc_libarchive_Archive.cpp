@@ -18,13 +18,23 @@
  */
 
 #include "lvfs_arc_libarchive_Archive.h"
-
+#include "../lvfs_arc_LibArchive.h"
+#include "lvfs_arc_libarchive_ZipDirectory.h"
+#include "lvfs_arc_libarchive_SevenZipBlocks.h"
+#include "lvfs_arc_libarchive_GzipStream.h"
+#include "lvfs_arc_libarchive_Bzip2Stream.h"
+#include "lvfs_arc_libarchive_XzStream.h"
+#include "lvfs_arc_libarchive_MappedFile.h"
+#include "lvfs_arc_libarchive_ReadAheadStream.h"
+
+#include <lvfs/IProperties>
 #include <brolly/assert.h>
 
 #include <archive.h>
 #include <archive_entry.h>
 
 #include <cstring>
+#include <errno.h>
 
 
 namespace LVFS {
@@ -32,16 +42,116 @@ namespace Arc {
 namespace LibArchive {
 
 namespace {
+    void supportModules(struct archive *archive, int formats, int filters)
+    {
+        if (formats == 0)
+        {
+            archive_read_support_filter_all(archive);
+            archive_read_support_format_all(archive);
+            return;
+        }
+
+        if (filters & Gzip)
+            archive_read_support_filter_gzip(archive);
+        if (filters & Bzip2)
+            archive_read_support_filter_bzip2(archive);
+        if (filters & Xz)
+            archive_read_support_filter_xz(archive);
+        if (filters & Lzma)
+            archive_read_support_filter_lzma(archive);
+        if (filters & Compress)
+            archive_read_support_filter_compress(archive);
+        if (filters & Rpm)
+            archive_read_support_filter_rpm(archive);
+
+        if (formats & Tar)
+            archive_read_support_format_tar(archive);
+        if (formats & Zip)
+            archive_read_support_format_zip(archive);
+        if (formats & SevenZip)
+            archive_read_support_format_7zip(archive);
+        if (formats & Ar)
+            archive_read_support_format_ar(archive);
+        if (formats & Cpio)
+            archive_read_support_format_cpio(archive);
+        if (formats & Iso9660)
+            archive_read_support_format_iso9660(archive);
+    }
+
+
     class ArchiveReader : public Archive::Reader
     {
     public:
-        enum { BlockSize = 65536 };
+        enum
+        {
+            BlockSize = 65536,
+            MappedBlockSize = 1024 * 1024
+        };
 
     public:
-        ArchiveReader(const Interface::Holder &file, const char *password) :
+        ArchiveReader(const Interface::Holder &file, const char *password, int formats, int filters) :
             Reader(file, password),
+            m_mapping(new (std::nothrow) MappedFile(file->as<IEntry>())),
+            m_formats(formats),
+            m_filters(filters),
+            m_mapped(false),
+            m_gzip(new (std::nothrow) GzipIndex()),
+            m_decompressed(false),
+            m_sequential(false),
             m_archive(NULL),
-            m_entry(NULL)
+            m_entry(NULL),
+            m_base(0),
+            m_position(0),
+            m_format(0),
+            m_unfiltered(false),
+            m_independent(false),
+            m_listingOnly(false),
+            m_listed(NULL),
+            m_cursor(0),
+            m_header(0),
+            m_headerEnd(0),
+            m_dataOffset(-1),
+            m_dataLeft(0),
+            m_probed(false),
+            m_block(NULL),
+            m_blockSize(0),
+            m_blockOffset(0),
+            m_blockPosition(0)
+        {
+            if (m_mapping.isValid() && !m_mapping->isValid())
+                m_mapping.reset();
+        }
+
+        ArchiveReader(const ArchiveReader &other) :
+            Reader(other.file(), other.password()),
+            m_mapping(other.m_mapping),
+            m_formats(other.m_formats),
+            m_filters(other.m_filters),
+            m_mapped(false),
+            m_gzip(other.m_gzip),
+            m_decompressed(false),
+            m_sequential(false),
+            m_archive(NULL),
+            m_entry(NULL),
+            m_base(0),
+            m_position(0),
+            m_format(other.m_format),
+            m_unfiltered(other.m_unfiltered),
+            m_independent(other.m_independent),
+            m_directory(other.m_directory),
+            m_blocks(other.m_blocks),
+            m_listingOnly(false),
+            m_listed(NULL),
+            m_cursor(0),
+            m_header(0),
+            m_headerEnd(0),
+            m_dataOffset(-1),
+            m_dataLeft(0),
+            m_probed(false),
+            m_block(NULL),
+            m_blockSize(0),
+            m_blockOffset(0),
+            m_blockPosition(0)
         {}
 
         virtual ~ArchiveReader()
@@ -49,6 +159,11 @@ namespace {
             close();
         }
 
+        virtual Reader *clone() const
+        {
+            return new (std::nothrow) ArchiveReader(*this);
+        }
+
         virtual bool isOpen() const
         {
             return m_archive != NULL;
@@ -57,25 +172,250 @@ namespace {
         virtual bool open()
         {
             ASSERT(m_archive == NULL);
-            m_archive = archive_read_new();
 
-            if (LIKELY(m_archive != NULL))
+            for (;;)
             {
-                archive_read_support_filter_all(m_archive);
-                archive_read_support_format_all(m_archive);
+                if (UNLIKELY((m_archive = archive_read_new()) == NULL))
+                    return false;
+
+                supportModules(m_archive, m_formats, m_filters);
+                m_base = 0;
+                m_header = 0;
+
+                if (LIKELY(openArchive(true) == ARCHIVE_OK))
+                {
+                    if (m_mapping.isValid())
+                        m_mapping->advise(0, m_mapping->size(), MappedFile::Sequential);
 
-                if (LIKELY(archive_read_open2(m_archive, this, open, read, skip, close) == ARCHIVE_OK))
                     return true;
-                else
-                    close();
+                }
+
+                close();
+
+                if (m_formats == 0)
+                    return false;
+
+                /* Contents do not match the type, every module bids from now on. */
+                m_formats = 0;
             }
+        }
 
-            return false;
+        virtual bool openListing()
+        {
+            unsigned char header[4];
+            IProperties *properties = file()->as<IProperties>();
+            ZipDirectory::Holder directory;
+
+            ASSERT(m_archive == NULL);
+
+            /* Zip (jar, apk, ...) lists from its central directory, local headers are not read. */
+            if (properties == NULL || (m_mapping.isValid() && !ZipDirectory::isZip(m_mapping->data(), m_mapping->size())))
+                return false;
+
+            Interface::Adaptor<IStream> stream(file()->as<IEntry>()->open());
+
+            if (!stream.isValid() || !ZipDirectory::isZip(header, stream->read(header, sizeof(header))))
+                return false;
+
+            directory.reset(new (std::nothrow) ZipDirectory());
+
+            if (!directory.isValid() || !directory->read(stream, properties->size()))
+                return false;
+
+            m_directory = directory;
+            m_format = ARCHIVE_FORMAT_ZIP;
+            m_unfiltered = true;
+            m_independent = true;
+            m_listingOnly = true;
+            m_cursor = 0;
+
+            return true;
         }
 
         virtual size_t read(void *buffer, size_t size)
         {
-            return archive_read_data(m_archive, buffer, size);
+            setError(0);
+
+            if (UNLIKELY(m_listingOnly))
+                return 0;
+
+            if (m_dataOffset < 0 && m_mapped && !m_probed)
+                direct();
+
+            if (m_dataOffset >= 0)
+            {
+                size_t res = m_dataLeft < static_cast<int64_t>(size) ? m_dataLeft : size;
+
+                if (m_mapped)
+                    ::memcpy(buffer, m_mapping->data() + m_dataOffset + ::archive_entry_size(m_entry) - m_dataLeft, res);
+                else if ((res = m_file->read(buffer, res)) == 0 && m_dataLeft > 0 && size > 0)
+                    setError(EIO);
+
+                m_dataLeft -= res;
+                return res;
+            }
+
+            if (m_block != NULL)
+                return readBlocks(static_cast<char *>(buffer), size);
+
+            ssize_t res = archive_read_data(m_archive, buffer, size);
+
+            if (res < 0)
+            {
+                setError(EIO);
+                return 0;
+            }
+
+            return res;
+        }
+
+        virtual size_t readBlock(void *buffer, size_t size, const void *&data, int64_t &offset)
+        {
+            const void *block;
+            size_t res;
+
+            setError(0);
+
+            if (UNLIKELY(m_listingOnly))
+                return 0;
+
+            if (m_dataOffset < 0 && m_mapped && !m_probed)
+                direct();
+
+            if (m_dataOffset >= 0)
+            {
+                offset = ::archive_entry_size(m_entry) - m_dataLeft;
+
+                if (!m_mapped)
+                {
+                    data = buffer;
+                    return read(buffer, size);
+                }
+
+                res = m_dataLeft < static_cast<int64_t>(size) ? m_dataLeft : size;
+                data = m_mapping->data() + m_dataOffset + offset;
+                m_dataLeft -= res;
+
+                return res;
+            }
+
+            /* Rest of the block taken by direct(). */
+            if (m_block != NULL && m_blockPosition < m_blockOffset + static_cast<int64_t>(m_blockSize))
+            {
+                res = m_blockOffset + m_blockSize - m_blockPosition;
+                data = m_block + (m_blockPosition - m_blockOffset);
+                offset = m_blockPosition;
+                m_blockPosition += res;
+
+                return res;
+            }
+
+            /* Blocks are handed out as libarchive has them, holes are left out. */
+            do
+                switch (archive_read_data_block(m_archive, &block, &res, &offset))
+                {
+                    case ARCHIVE_OK:
+                    case ARCHIVE_WARN:
+                        break;
+
+                    case ARCHIVE_EOF:
+                        return 0;
+
+                    default:
+                        setError(EIO);
+                        return 0;
+                }
+            while (res == 0);
+
+            data = block;
+            return res;
+        }
+
+        virtual bool seek(int64_t offset)
+        {
+            if (m_dataOffset < 0 && !direct())
+            {
+                /* Data of a plain tar member is stored as is right after its header. */
+                if (m_mapped || m_format != ARCHIVE_FORMAT_TAR || !m_unfiltered || m_sequential ||
+                    ::archive_entry_sparse_count(m_entry) != 0)
+                {
+                    return false;
+                }
+
+                m_dataOffset = m_headerEnd;
+                setIndex(NoIndex);
+            }
+
+            if (offset > ::archive_entry_size(m_entry) ||
+                (m_mapped ? m_dataOffset + ::archive_entry_size(m_entry) > m_mapping->size() :
+                            !m_file->seek(m_dataOffset + offset, static_cast<IStream::Whence>(SEEK_SET))))
+            {
+                return false;
+            }
+
+            m_dataLeft = ::archive_entry_size(m_entry) - offset;
+            return true;
+        }
+
+        virtual bool direct()
+        {
+            const void *block;
+            size_t size;
+            int64_t offset;
+            int64_t data = -1;
+
+            if (m_dataOffset >= 0)
+                return m_mapped;
+
+            if (!m_mapped || m_probed || m_entry == NULL)
+                return false;
+
+            m_probed = true;
+
+            if (::archive_entry_sparse_count(m_entry) != 0 || !::archive_entry_size_is_set(m_entry))
+                return false;
+
+            if (m_format == ARCHIVE_FORMAT_TAR && m_unfiltered)
+                data = m_headerEnd;
+            else if (m_format == ARCHIVE_FORMAT_ZIP && m_directory.isValid())
+            {
+                if (const ZipDirectory::Entry *entry = directoryEntry())
+                    if (entry->size == ::archive_entry_size(m_entry))
+                        data = ZipDirectory::stored(*entry, m_mapping->data(), m_mapping->size());
+            }
+            else if (m_format == ARCHIVE_FORMAT_ISO9660 && m_unfiltered && ::archive_entry_size(m_entry) > 0)
+            {
+                /*
+                 * Extent of a file is known to libarchive only, it is found where the
+                 * first block points to. Blocks copied by libarchive (zisofs, a block
+                 * crossing a mapped block) are read by blocks from then on.
+                 */
+                if (archive_read_data_block(m_archive, &block, &size, &offset) != ARCHIVE_OK)
+                    return false;
+
+                if (offset == 0 && static_cast<const unsigned char *>(block) >= m_mapping->data() &&
+                    static_cast<const unsigned char *>(block) + ::archive_entry_size(m_entry) <= m_mapping->data() + m_mapping->size())
+                {
+                    data = static_cast<const unsigned char *>(block) - m_mapping->data();
+                }
+                else
+                {
+                    m_block = static_cast<const char *>(block);
+                    m_blockSize = size;
+                    m_blockOffset = offset;
+                    m_blockPosition = 0;
+                    return false;
+                }
+            }
+
+            if (data < 0 || data + ::archive_entry_size(m_entry) > m_mapping->size())
+                return false;
+
+            m_dataOffset = data;
+            m_dataLeft = ::archive_entry_size(m_entry);
+            m_mapping->advise(m_dataOffset, m_dataLeft, MappedFile::Sequential);
+
+            return true;
         }
 
         virtual void close()
@@ -83,75 +423,470 @@ namespace {
             archive_read_free(m_archive);
             m_archive = NULL;
             m_entry = NULL;
+            m_dataOffset = -1;
+            m_probed = false;
+            m_block = NULL;
+            m_listingOnly = false;
+            m_listed = NULL;
             m_file.reset();
+            m_source.reset();
         }
 
         virtual bool next()
         {
-            while (archive_read_next_header(m_archive, &m_entry) == ARCHIVE_OK)
+            int res;
+
+            setError(0);
+
+            /* Members are listed in the order of their local headers, as a full read would. */
+            if (m_listingOnly)
+            {
+                while (m_cursor < m_directory->count())
+                {
+                    m_listed = m_directory->ordered(m_cursor++);
+
+                    if (m_listed->path[0] != 0 && m_listed->path[::strlen(m_listed->path) - 1] != '/')
+                        return true;
+                }
+
+                return false;
+            }
+
+            /* Data read from the file leaves libarchive where it was. */
+            if (m_dataOffset >= 0 && !m_mapped)
+            {
+                setError(ESPIPE);
+                return false;
+            }
+
+            m_dataOffset = -1;
+            m_probed = false;
+            m_block = NULL;
+
+            while ((res = archive_read_next_header(m_archive, &m_entry)) == ARCHIVE_OK || res == ARCHIVE_WARN)
+            {
+                /* Directories have local headers too. */
+                ++m_header;
+
                 if (::archive_entry_pathname(m_entry)[strlen(::archive_entry_pathname(m_entry)) - 1] != '/')
+                {
+                    /* Readers opened at an offset of a cached listing learn it here too. */
+                    if (m_format == 0)
+                    {
+                        initFormat();
+
+                        if (m_base != 0 && m_directory.isValid())
+                            m_header = m_directory->position(m_base) + 1;
+                    }
+
+                    m_headerEnd = m_base + archive_filter_bytes(m_archive, 0);
                     return true;
+                }
+            }
+
+            if (res != ARCHIVE_EOF)
+                setError(EIO);
 
             return false;
         }
 
+        virtual bool locate(const char *path, uint32_t index, int64_t offset)
+        {
+            if (offset >= 0)
+            {
+                close();
+
+                if (openAt(offset))
+                    if (next() && ::strcmp(path, ::archive_entry_pathname(m_entry)) == 0)
+                    {
+                        /* Position of this reader in the archive is unknown now. */
+                        setIndex(NoIndex);
+                        return true;
+                    }
+                    else
+                        close();
+            }
+
+            return Reader::locate(path, index, offset);
+        }
+
+        virtual bool independent() const
+        {
+            /* Listing came from the index cache, no header was read yet. */
+            if (m_format == 0 && m_archive == NULL)
+                const_cast<ArchiveReader *>(this)->detect();
+
+            return m_independent;
+        }
+
+        virtual uint32_t block(uint32_t index) const
+        {
+            /*
+             * Only folders of 7z are solid blocks. A compressed tarball is one
+             * stream too, but keeping all members passed on the way would copy
+             * the whole archive into the cache.
+             */
+            if (m_format == ARCHIVE_FORMAT_7ZIP && m_blocks.isValid())
+                return m_blocks->block(index);
+
+            return NoBlock;
+        }
+
         virtual const char *archive_entry_pathname() const
         {
+            if (m_listingOnly)
+                return m_listed->path;
+
             ASSERT(m_entry != NULL);
             return ::archive_entry_pathname(m_entry);
         }
 
         virtual time_t archive_entry_ctime() const
         {
+            if (m_listingOnly)
+                return 0;
+
             ASSERT(m_entry != NULL);
             return ::archive_entry_birthtime(m_entry);
         }
 
         virtual time_t archive_entry_mtime() const
         {
+            if (m_listingOnly)
+                return m_listed->mTime;
+
             ASSERT(m_entry != NULL);
             return ::archive_entry_mtime(m_entry);
         }
 
         virtual time_t archive_entry_atime() const
         {
+            if (m_listingOnly)
+                return 0;
+
             ASSERT(m_entry != NULL);
             return ::archive_entry_atime(m_entry);
         }
 
         virtual mode_t archive_entry_perm() const
         {
+            if (m_listingOnly)
+                return m_listed->perm;
+
             ASSERT(m_entry != NULL);
             return ::archive_entry_perm(m_entry);
         }
 
         virtual int64_t archive_entry_size() const
         {
+            if (m_listingOnly)
+                return m_listed->size;
+
             ASSERT(m_entry != NULL);
             return ::archive_entry_size(m_entry);
         }
 
+        virtual int64_t archive_entry_offset() const
+        {
+            if (m_listingOnly)
+                return m_listed->offset;
+
+            ASSERT(m_entry != NULL);
+
+            if (m_directory.isValid())
+            {
+                if (const ZipDirectory::Entry *entry = directoryEntry())
+                    return entry->offset;
+            }
+            else if (m_format == ARCHIVE_FORMAT_TAR && m_unfiltered && !m_sequential)
+                return ::archive_read_header_position(m_archive);
+
+            return -1;
+        }
+
+        virtual bool archive_entry_sparse() const
+        {
+            return !m_listingOnly && m_entry != NULL && ::archive_entry_sparse_count(m_entry) != 0;
+        }
+
+        virtual const char *archive_entry_symlink() const
+        {
+            if (m_listingOnly || m_entry == NULL || ::archive_entry_filetype(m_entry) != AE_IFLNK)
+                return NULL;
+
+            return ::archive_entry_symlink(m_entry);
+        }
+
     private:
-        static int open(struct archive *archive, void *_client_data)
+        /*
+         * Central directory record of the current zip entry, found by position
+         * as names may repeat. NULL if the local header is not the one listed
+         * there (a member missing from the directory shifts the ones after it).
+         */
+        const ZipDirectory::Entry *directoryEntry() const
         {
-            static int archive_res[2] = { ARCHIVE_FAILED, ARCHIVE_OK };
-            ArchiveReader *self = static_cast<ArchiveReader *>(_client_data);
-            return archive_res[(self->m_file = self->file()->as<IEntry>()->open()).isValid()];
+            const ZipDirectory::Entry *entry = m_directory->ordered(m_header - 1);
+            return entry != NULL && ::strcmp(entry->path, ::archive_entry_pathname(m_entry)) == 0 ? entry : NULL;
+        }
+
+        size_t readBlocks(char *buffer, size_t size)
+        {
+            const void *block;
+            size_t res = 0;
+            size_t len;
+            int status;
+
+            while (res < size)
+            {
+                if (m_blockPosition >= m_blockOffset + static_cast<int64_t>(m_blockSize))
+                {
+                    if ((status = archive_read_data_block(m_archive, &block, &m_blockSize, &m_blockOffset)) != ARCHIVE_OK &&
+                        status != ARCHIVE_WARN)
+                    {
+                        if (status != ARCHIVE_EOF)
+                            setError(EIO);
+
+                        break;
+                    }
+
+                    m_block = static_cast<const char *>(block);
+                }
+
+                /* Holes between blocks read as zeros. */
+                if (m_blockPosition < m_blockOffset)
+                {
+                    len = m_blockOffset - m_blockPosition < static_cast<int64_t>(size - res) ? m_blockOffset - m_blockPosition : size - res;
+                    ::memset(buffer + res, 0, len);
+                }
+                else
+                {
+                    len = m_blockOffset + m_blockSize - m_blockPosition < size - res ? m_blockOffset + m_blockSize - m_blockPosition : size - res;
+                    ::memcpy(buffer + res, m_block + (m_blockPosition - m_blockOffset), len);
+                }
+
+                m_blockPosition += len;
+                res += len;
+            }
+
+            return res;
+        }
+
+        bool openAt(int64_t offset)
+        {
+            ASSERT(m_archive == NULL);
+            m_archive = archive_read_new();
+
+            if (LIKELY(m_archive != NULL))
+            {
+                /* Local file header of a zip member and a tar header are self-contained. */
+                archive_read_support_format_zip_streamable(m_archive);
+                archive_read_support_format_tar(m_archive);
+
+                m_base = offset;
+                m_header = m_directory.isValid() ? m_directory->position(offset) : 0;
+
+                if (LIKELY(openArchive(false) == ARCHIVE_OK))
+                {
+                    if (m_mapped)
+                        m_mapping->advise(offset, MappedBlockSize, MappedFile::WillNeed);
+
+                    return true;
+                }
+                else
+                    close();
+            }
+
+            return false;
+        }
+
+        int openArchive(bool seekable)
+        {
+            if (!openSource())
+                return ARCHIVE_FATAL;
+
+            /* Seekable readers (zip, 7z, ISO) jump over data instead of reading it. */
+            if (seekable && (m_mapped || (!m_decompressed && file()->as<IProperties>() != NULL)))
+                archive_read_set_seek_callback(m_archive, seek);
+
+            archive_read_set_read_callback(m_archive, read);
+            archive_read_set_skip_callback(m_archive, skip);
+            archive_read_set_close_callback(m_archive, close);
+            archive_read_set_callback_data(m_archive, this);
+
+            return archive_read_open1(m_archive);
+        }
+
+        bool openSource()
+        {
+            unsigned char header[6];
+            size_t res;
+
+            m_position = 0;
+            m_sequential = false;
+
+            /* Plain local files are handed to libarchive straight from the mapping. */
+            if (m_mapping.isValid() && !isCompressed(m_mapping->data(), m_mapping->size()))
+            {
+                m_mapped = true;
+                m_decompressed = false;
+                return m_base <= m_mapping->size();
+            }
+
+            m_mapped = false;
+
+            if (!(m_file = m_source = file()->as<IEntry>()->open()).isValid())
+                return false;
+
+            /*
+             * Gzip is decompressed here to keep checkpoints for random access,
+             * bzip2 and xz to spread decompression over all cores. The latter
+             * seek by decoding from the start, so offsets in them are not used.
+             */
+            res = m_file->read(header, sizeof(header));
+
+            if (!m_file->seek(0, static_cast<IStream::Whence>(SEEK_SET)) &&
+                !(m_file = m_source = file()->as<IEntry>()->open()).isValid())
+            {
+                return false;
+            }
+
+            /* Source I/O overlaps with decompression. */
+            if (uint32_t blocks = ReadAheadStream::blocks())
+            {
+                m_file = m_source = Interface::Holder(new (std::nothrow) ReadAheadStream(m_source, blocks));
+
+                if (UNLIKELY(!m_file.isValid()))
+                    return false;
+            }
+
+            if (m_decompressed = GzipIndex::isGzip(header, res))
+            {
+                if (UNLIKELY(m_gzip.isValid() == false))
+                    return false;
+
+                m_file = Interface::Holder(new (std::nothrow) GzipStream(m_source, m_gzip));
+
+                if (UNLIKELY(!m_file.isValid()))
+                    return false;
+            }
+            else if (m_sequential = m_decompressed = Bzip2Stream::isBzip2(header, res))
+            {
+                m_file = Interface::Holder(new (std::nothrow) Bzip2Stream(m_source));
+
+                if (UNLIKELY(!m_file.isValid()))
+                    return false;
+            }
+            else if (m_sequential = m_decompressed = XzStream::isXz(header, res))
+            {
+                m_file = Interface::Holder(new (std::nothrow) XzStream(m_source));
+
+                if (UNLIKELY(!m_file.isValid()))
+                    return false;
+            }
+
+            if (m_base == 0 || m_file->seek(m_base, static_cast<IStream::Whence>(SEEK_SET)))
+                return true;
+
+            m_file.reset();
+            return false;
+        }
+
+        static bool isCompressed(const unsigned char *header, size_t size)
+        {
+            return GzipIndex::isGzip(header, size) || Bzip2Stream::isBzip2(header, size) || XzStream::isXz(header, size);
+        }
+
+        void detect()
+        {
+            if (open())
+            {
+                next();
+                close();
+            }
+
+            setError(0);
         }
 
+        void initFormat()
+        {
+            m_format = archive_format(m_archive) & ARCHIVE_FORMAT_BASE_MASK;
+            m_unfiltered = archive_filter_count(m_archive) == 1;
+
+            if (m_format == ARCHIVE_FORMAT_ZIP && m_unfiltered && !m_directory.isValid())
+            {
+                Interface::Adaptor<IStream> stream(file()->as<IEntry>()->open());
+
+                if (stream.isValid())
+                {
+                    m_directory.reset(new (std::nothrow) ZipDirectory());
+
+                    if (m_directory.isValid() && !m_directory->read(stream, file()->as<IProperties>()->size()))
+                        m_directory.reset();
+                }
+            }
+
+            if (m_format == ARCHIVE_FORMAT_7ZIP && m_unfiltered && !m_blocks.isValid())
+            {
+                Interface::Adaptor<IStream> stream(file()->as<IEntry>()->open());
+
+                if (stream.isValid())
+                {
+                    m_blocks.reset(new (std::nothrow) SevenZipBlocks());
+
+                    if (m_blocks.isValid() && !m_blocks->read(stream, file()->as<IProperties>()->size()))
+                        m_blocks.reset();
+                }
+            }
+
+            /* Compressed tarballs have offsets too, but reaching them means decompressing all before. */
+            m_independent = m_unfiltered && !m_decompressed &&
+                            (m_directory.isValid() || m_format == ARCHIVE_FORMAT_TAR);
+        }
+
+    private:
         static ssize_t read(struct archive *archive, void *_client_data, const void **_buffer)
         {
             ArchiveReader *self = static_cast<ArchiveReader *>(_client_data);
-            (*_buffer) = self->m_buffer;
-            return self->m_file->read(self->m_buffer, BlockSize);
+            size_t res;
+
+            if (self->m_mapped)
+            {
+                int64_t offset = self->m_base + self->m_position;
+                int64_t left = self->m_mapping->size() - offset;
+
+                res = left < MappedBlockSize ? left : MappedBlockSize;
+                (*_buffer) = self->m_mapping->data() + offset;
+                self->m_mapping->advise(offset + res, MappedBlockSize, MappedFile::WillNeed);
+            }
+            else
+            {
+                res = self->m_file->read(self->m_buffer, BlockSize);
+                (*_buffer) = self->m_buffer;
+            }
+
+            self->m_position += res;
+            return res;
         }
 
         static int64_t skip(struct archive *archive, void *_client_data, int64_t request)
         {
             ArchiveReader *self = static_cast<ArchiveReader *>(_client_data);
 
-            if (self->m_file->seek(request, IStream::FromCurrent))
+            if (self->m_mapped)
+            {
+                int64_t left = self->m_mapping->size() - self->m_base - self->m_position;
+
+                if (request > left)
+                    request = left;
+
+                self->m_position += request;
+                return request;
+            }
+            else if (self->m_file->seek(request, IStream::FromCurrent))
+            {
+                self->m_position += request;
                 return request;
+            }
             else
                 return 0;
         }
@@ -160,8 +895,26 @@ namespace {
         {
             ArchiveReader *self = static_cast<ArchiveReader *>(_client_data);
 
-            if (self->m_file->seek(offset, static_cast<IStream::Whence>(whence)))
-                return offset;
+            switch (whence)
+            {
+                case SEEK_CUR:
+                    offset += self->m_position;
+                    break;
+
+                case SEEK_END:
+                    offset += (self->m_mapped ? self->m_mapping->size() : self->file()->as<IProperties>()->size()) - self->m_base;
+                    break;
+
+                default:
+                    break;
+            }
+
+            if (offset < 0)
+                return ARCHIVE_FATAL;
+
+            if (self->m_mapped ? self->m_base + offset <= self->m_mapping->size() :
+                                 self->m_file->seek(self->m_base + offset, static_cast<IStream::Whence>(SEEK_SET)))
+                return self->m_position = offset;
             else
                 return ARCHIVE_FATAL;
         }
@@ -169,30 +922,58 @@ namespace {
         static int close(struct archive *archive, void *_client_data)
         {
             static_cast<ArchiveReader *>(_client_data)->m_file.reset();
+            static_cast<ArchiveReader *>(_client_data)->m_source.reset();
             return ARCHIVE_OK;
         }
 
     private:
+        MappedFile::Holder m_mapping;
+        int m_formats;
+        int m_filters;
+        bool m_mapped;
         Interface::Adaptor<IStream> m_file;
+        Interface::Holder m_source;
+        GzipIndex::Holder m_gzip;
+        bool m_decompressed;
+        bool m_sequential;
         mutable struct archive *m_archive;
         mutable struct archive_entry *m_entry;
+        int64_t m_base;
+        int64_t m_position;
+        int m_format;
+        bool m_unfiltered;
+        bool m_independent;
+        ZipDirectory::Holder m_directory;
+        SevenZipBlocks::Holder m_blocks;
+        bool m_listingOnly;
+        const ZipDirectory::Entry *m_listed;
+        uint32_t m_cursor;
+        uint32_t m_header;
+        int64_t m_headerEnd;
+        int64_t m_dataOffset;
+        int64_t m_dataLeft;
+        bool m_probed;
+        const char *m_block;
+        size_t m_blockSize;
+        int64_t m_blockOffset;
+        int64_t m_blockPosition;
         char m_buffer[BlockSize];
     };
 }
 
 
-Archive::Archive(const Interface::Holder &file) :
-    Arc::Archive(file)
+Archive::Archive(const Interface::Holder &file, int formats, int filters) :
+    Arc::Archive(file),
+    m_formats(formats),
+    m_filters(filters)
 {}
 
 Archive::~Archive()
 {}
 
-Archive::const_iterator Archive::begin() const
+Archive::ReaderHolder Archive::createReader() const
 {
-    ArchiveReader::Holder reader(new (std::nothrow) ArchiveReader(original(), password()));
-    const_cast<Archive *>(this)->process(reader);
-    return std_iterator<Entries>(entries().begin());
+    return ReaderHolder(new (std::nothrow) ArchiveReader(original(), password(), m_formats, m_filters));
 }
 
 }}}
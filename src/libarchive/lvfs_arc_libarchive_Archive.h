@@ -30,11 +30,15 @@ namespace LibArchive {
 class PLATFORM_MAKE_PRIVATE Archive : public Arc::Archive
 {
 public:
-    Archive(const Interface::Holder &file);
+    Archive(const Interface::Holder &file, int formats, int filters);
     virtual ~Archive();
 
-public: /* IDirectory */
-    virtual const_iterator begin() const;
+protected:
+    virtual ReaderHolder createReader() const;
+
+private:
+    int m_formats;
+    int m_filters;
 };
 
 }}}
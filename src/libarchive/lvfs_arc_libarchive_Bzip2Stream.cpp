@@ -0,0 +1,958 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "lvfs_arc_libarchive_Bzip2Stream.h"
+
+#include <brolly/assert.h>
+
+#include <bzlib.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <unistd.h>
+
+
+namespace LVFS {
+namespace Arc {
+namespace LibArchive {
+
+namespace {
+    enum
+    {
+        /* "BZh", block size and the magic of the first block. */
+        HeaderSize = 10,
+        MagicBits = 48,
+        CrcBits = 32
+    };
+
+    const uint64_t BlockMagic = UINT64_C(0x314159265359);
+    const uint64_t EndMagic = UINT64_C(0x177245385090);
+
+    inline bool isStreamHeader(const unsigned char *data)
+    {
+        return data[0] == 'B' && data[1] == 'Z' && data[2] == 'h' && data[3] >= '1' && data[3] <= '9';
+    }
+
+    inline bool isHeader(const unsigned char *data)
+    {
+        static const unsigned char magic[6] = { 0x31, 0x41, 0x59, 0x26, 0x53, 0x59 };
+        return isStreamHeader(data) && ::memcmp(data + 4, magic, sizeof(magic)) == 0;
+    }
+
+    /* Bits [bit, bit + count) of data, 32 at most. */
+    inline uint64_t peek(const unsigned char *data, uint64_t bit, unsigned int count)
+    {
+        size_t first = bit / 8;
+        size_t last = (bit + count + 7) / 8;
+        uint64_t value = 0;
+
+        for (size_t i = first; i < last; ++i)
+            value = (value << 8) | data[i];
+
+        return (value >> (8 * last - bit - count)) & ((UINT64_C(1) << count) - 1);
+    }
+
+    /* Appends count bits of value to data zeroed beforehand. */
+    inline void put(unsigned char *data, uint64_t &bit, uint64_t value, unsigned int count)
+    {
+        while (count-- > 0)
+        {
+            if ((value >> count) & 1)
+                data[bit / 8] |= 0x80 >> (bit % 8);
+
+            ++bit;
+        }
+    }
+
+    /* Bytes a magic at any shift has right before the last byte it ends in, others are passed by. */
+    struct Candidates
+    {
+        Candidates()
+        {
+            ::memset(table, 0, sizeof(table));
+
+            for (unsigned int shift = 0; shift < 8; ++shift)
+            {
+                table[((BlockMagic << shift) >> 8) & 0xFF] = true;
+                table[((EndMagic << shift) >> 8) & 0xFF] = true;
+            }
+        }
+
+        bool table[256];
+    };
+
+    /* First block or end of stream magic starting at bit from or after it. */
+    bool find(const unsigned char *data, size_t size, uint64_t from, uint64_t &bit, bool &end)
+    {
+        static const Candidates candidates;
+        uint64_t window = 0;
+        uint64_t value;
+
+        for (size_t i = from / 8; i < size; ++i)
+        {
+            window = (window << 8) | data[i];
+
+            if (8 * i + 8 < from + MagicBits || !candidates.table[data[i - 1]])
+                continue;
+
+            for (unsigned int shift = 8; shift-- > 0;)
+                if (8 * i + 8 - MagicBits >= from + shift)
+                {
+                    value = (window >> shift) & ((UINT64_C(1) << MagicBits) - 1);
+
+                    if (value == BlockMagic || value == EndMagic)
+                    {
+                        bit = 8 * i + 8 - MagicBits - shift;
+                        end = value == EndMagic;
+                        return true;
+                    }
+                }
+        }
+
+        return false;
+    }
+
+    bz_stream *create()
+    {
+        bz_stream *stream = new (std::nothrow) bz_stream;
+
+        if (LIKELY(stream != NULL))
+        {
+            ::memset(stream, 0, sizeof(bz_stream));
+
+            if (::BZ2_bzDecompressInit(stream, 0, 0) != BZ_OK)
+            {
+                delete stream;
+                return NULL;
+            }
+        }
+
+        return stream;
+    }
+
+    void destroy(bz_stream *stream)
+    {
+        if (stream)
+        {
+            ::BZ2_bzDecompressEnd(stream);
+            delete stream;
+        }
+    }
+}
+
+
+/* Hand-over of an unfinished stream from one job to the next. */
+struct Bzip2Stream::Link
+{
+    bz_stream *stream;
+    bool ready;
+    bool failed;
+};
+
+struct Bzip2Stream::Job
+{
+    Bzip2Stream *owner;
+    unsigned char *in;
+    size_t inSize;
+    char *out;
+    size_t outSize;
+    size_t outCapacity;
+    size_t consumed;
+    Link *from;
+    Link *to;
+    bool done;
+    bool failed;
+
+    /* Blocks at bits [first, last) of the input, wrapped into a stream by assemble(). */
+    bool split;
+    char level;
+    uint64_t first;
+    uint64_t last;
+    uint32_t crc;
+};
+
+
+Bzip2Stream::Bzip2Stream(const Interface::Holder &file) :
+    m_file(file),
+    m_abort(false),
+    m_stop(false),
+    m_workerCount(0),
+    m_idle(0),
+    m_first(0),
+    m_count(0),
+    m_launched(0),
+    m_started(0),
+    m_split(true),
+    m_header(true),
+    m_level(0),
+    m_shift(0),
+    m_memory(0),
+    m_link(NULL),
+    m_pending(NULL),
+    m_pendingSize(0),
+    m_pendingCapacity(0),
+    m_eof(false),
+    m_failed(false),
+    m_out(0)
+{
+    long cpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+
+    ASSERT(m_file.isValid());
+    ::pthread_mutex_init(&m_mutex, NULL);
+    ::pthread_cond_init(&m_cond, NULL);
+
+    /* One job is always being read, the rest decompress ahead on a worker each. */
+    m_window = cpus < 1 ? 2 : cpus >= MaxJobs ? MaxJobs : cpus + 1;
+}
+
+Bzip2Stream::~Bzip2Stream()
+{
+    clear();
+
+    ::pthread_mutex_lock(&m_mutex);
+    m_stop = true;
+    ::pthread_cond_broadcast(&m_cond);
+    ::pthread_mutex_unlock(&m_mutex);
+
+    for (unsigned int i = 0; i < m_workerCount; ++i)
+        ::pthread_join(m_workers[i], NULL);
+
+    ::pthread_cond_destroy(&m_cond);
+    ::pthread_mutex_destroy(&m_mutex);
+}
+
+bool Bzip2Stream::isBzip2(const unsigned char *header, size_t size)
+{
+    return size >= 3 && header[0] == 'B' && header[1] == 'Z' && header[2] == 'h';
+}
+
+size_t Bzip2Stream::read(void *buffer, size_t size)
+{
+    size_t res = 0;
+    size_t len;
+    int64_t out;
+    Job *job;
+
+    while (res < size && !m_failed)
+    {
+        while (m_count < m_window && (m_count == 0 || __atomic_load_n(&m_memory, __ATOMIC_RELAXED) < MaxMemory) && launch())
+            continue;
+
+        if (m_count == 0)
+            break;
+
+        job = m_jobs[m_first];
+
+        ::pthread_mutex_lock(&m_mutex);
+        while (!job->done)
+            ::pthread_cond_wait(&m_cond, &m_mutex);
+        ::pthread_mutex_unlock(&m_mutex);
+
+        if (job->failed)
+        {
+            /* Block magic found in compressed data cut a block, see the class comment. */
+            if (job->split)
+            {
+                out = m_out;
+                m_split = false;
+
+                if (restart() && skip(out))
+                    continue;
+
+                if (m_failed)
+                    break;
+            }
+
+            m_error = Error(EIO);
+            m_failed = true;
+            break;
+        }
+
+        len = job->outSize - job->consumed;
+
+        if (len > size - res)
+            len = size - res;
+
+        ::memcpy(static_cast<char *>(buffer) + res, job->out + job->consumed, len);
+        job->consumed += len;
+        m_out += len;
+        res += len;
+
+        if (job->consumed == job->outSize)
+        {
+            __atomic_sub_fetch(&m_memory, job->inSize + job->outCapacity, __ATOMIC_RELAXED);
+            ::free(job->in);
+            ::free(job->out);
+
+            if (job->from)
+            {
+                destroy(job->from->stream);
+                delete job->from;
+            }
+
+            delete job;
+            m_first = (m_first + 1) % MaxJobs;
+            --m_count;
+        }
+    }
+
+    return res;
+}
+
+size_t Bzip2Stream::write(const void *buffer, size_t size)
+{
+    m_error = Error(EROFS);
+    return 0;
+}
+
+bool Bzip2Stream::advise(off_t offset, off_t len, Advise advise)
+{
+    m_error = Error(EROFS);
+    return false;
+}
+
+bool Bzip2Stream::seek(long offset, Whence whence)
+{
+    int64_t target;
+
+    switch (whence)
+    {
+        case SEEK_SET:
+            target = offset;
+            break;
+
+        case SEEK_CUR:
+            target = m_out + offset;
+            break;
+
+        default:
+            m_error = Error(ESPIPE);
+            return false;
+    }
+
+    if (target < 0)
+    {
+        m_error = Error(EINVAL);
+        return false;
+    }
+
+    if (target < m_out && !restart())
+        return false;
+
+    return skip(target - m_out);
+}
+
+bool Bzip2Stream::flush()
+{
+    m_error = Error(EROFS);
+    return false;
+}
+
+const Error &Bzip2Stream::lastError() const
+{
+    return m_error;
+}
+
+void *Bzip2Stream::worker(void *self)
+{
+    Bzip2Stream *stream = static_cast<Bzip2Stream *>(self);
+    Job *job;
+
+    ::pthread_mutex_lock(&stream->m_mutex);
+
+    for (;;)
+        if (stream->m_started != stream->m_launched)
+        {
+            job = stream->m_jobs[stream->m_started++ % MaxJobs];
+            ::pthread_mutex_unlock(&stream->m_mutex);
+
+            stream->decompress(job);
+
+            ::pthread_mutex_lock(&stream->m_mutex);
+        }
+        else if (stream->m_stop)
+            break;
+        else
+        {
+            ++stream->m_idle;
+            ::pthread_cond_wait(&stream->m_cond, &stream->m_mutex);
+            --stream->m_idle;
+        }
+
+    ::pthread_mutex_unlock(&stream->m_mutex);
+    return NULL;
+}
+
+void Bzip2Stream::decompress(Job *job)
+{
+    bz_stream *stream = NULL;
+    bool ok = true;
+    char *out;
+    size_t capacity;
+    int res;
+
+    if (job->split)
+        ok = !__atomic_load_n(&m_abort, __ATOMIC_RELAXED) && assemble(job);
+    else if (job->from)
+    {
+        ::pthread_mutex_lock(&m_mutex);
+        while (!job->from->ready && !m_abort)
+            ::pthread_cond_wait(&m_cond, &m_mutex);
+        ok = job->from->ready && !job->from->failed;
+        stream = job->from->stream;
+        job->from->stream = NULL;
+        ::pthread_mutex_unlock(&m_mutex);
+    }
+
+    if (ok && stream == NULL)
+        ok = (stream = create()) != NULL;
+
+    if (ok)
+    {
+        stream->next_in = reinterpret_cast<char *>(job->in);
+        stream->avail_in = job->inSize;
+    }
+
+    while (ok)
+    {
+        if (__atomic_load_n(&m_abort, __ATOMIC_RELAXED))
+        {
+            ok = false;
+            break;
+        }
+
+        if (job->outSize == job->outCapacity)
+        {
+            capacity = job->outCapacity ? job->outCapacity * 2 : job->inSize * 4 + BufferSize;
+
+            if (UNLIKELY((out = static_cast<char *>(::realloc(job->out, capacity))) == NULL))
+            {
+                ok = false;
+                break;
+            }
+
+            __atomic_add_fetch(&m_memory, capacity - job->outCapacity, __ATOMIC_RELAXED);
+            job->out = out;
+            job->outCapacity = capacity;
+        }
+
+        stream->next_out = job->out + job->outSize;
+        stream->avail_out = job->outCapacity - job->outSize;
+
+        res = ::BZ2_bzDecompress(stream);
+        job->outSize = job->outCapacity - stream->avail_out;
+
+        if (res == BZ_STREAM_END)
+        {
+            char *next = stream->next_in;
+            unsigned int avail = stream->avail_in;
+
+            ::BZ2_bzDecompressEnd(stream);
+
+            /* Anything but another stream after the end is trailing garbage. */
+            if (avail < HeaderSize || !isHeader(reinterpret_cast<unsigned char *>(next)))
+            {
+                delete stream;
+                stream = NULL;
+                break;
+            }
+
+            ::memset(stream, 0, sizeof(bz_stream));
+
+            if (::BZ2_bzDecompressInit(stream, 0, 0) != BZ_OK)
+            {
+                delete stream;
+                stream = NULL;
+                ok = false;
+                break;
+            }
+
+            stream->next_in = next;
+            stream->avail_in = avail;
+        }
+        else if (res != BZ_OK)
+            ok = false;
+        else if (stream->avail_in == 0 && stream->avail_out > 0)
+        {
+            /* Stream goes on in the next job, or the input is truncated. */
+            ok = job->to != NULL;
+            break;
+        }
+    }
+
+    if (!ok)
+    {
+        destroy(stream);
+        stream = NULL;
+    }
+
+    ::pthread_mutex_lock(&m_mutex);
+
+    if (job->to)
+    {
+        job->to->stream = stream;
+        job->to->failed = !ok;
+        job->to->ready = true;
+    }
+    else
+        destroy(stream);
+
+    job->failed = !ok;
+    job->done = true;
+    ::pthread_cond_broadcast(&m_cond);
+    ::pthread_mutex_unlock(&m_mutex);
+}
+
+bool Bzip2Stream::assemble(Job *job)
+{
+    const unsigned char *from = job->in + job->first / 8;
+    unsigned int shift = job->first % 8;
+    uint64_t bits = job->last - job->first;
+    size_t bytes = bits / 8;
+    size_t size = 4 + (bits + MagicBits + CrcBits + 7) / 8;
+    unsigned char *data;
+    uint64_t bit;
+
+    if (UNLIKELY((data = static_cast<unsigned char *>(::malloc(size))) == NULL))
+        return false;
+
+    /* Header of the stream the blocks came from, the blocks and the end of a stream of their own. */
+    data[0] = 'B';
+    data[1] = 'Z';
+    data[2] = 'h';
+    data[3] = job->level;
+
+    if (shift == 0)
+        ::memcpy(data + 4, from, bytes);
+    else
+        for (size_t i = 0; i < bytes; ++i)
+            data[4 + i] = (from[i] << shift) | (from[i + 1] >> (8 - shift));
+
+    ::memset(data + 4 + bytes, 0, size - 4 - bytes);
+    bit = 8 * (4 + bytes);
+
+    for (uint64_t i = job->first + 8 * bytes; i < job->last; ++i)
+        put(data, bit, (job->in[i / 8] >> (7 - i % 8)) & 1, 1);
+
+    put(data, bit, EndMagic, MagicBits);
+    put(data, bit, job->crc, CrcBits);
+
+    __atomic_add_fetch(&m_memory, size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&m_memory, job->inSize, __ATOMIC_RELAXED);
+    ::free(job->in);
+    job->in = data;
+    job->inSize = size;
+
+    return true;
+}
+
+bool Bzip2Stream::launch()
+{
+    size_t end = 0;
+    bool open = false;
+    unsigned char *rest;
+    size_t restSize;
+    Job *job;
+
+    while (m_pendingSize < JobSize + HeaderSize && fill())
+        continue;
+
+    if (m_pendingSize == 0 || m_failed)
+        return false;
+
+    if (UNLIKELY((job = new (std::nothrow) Job) == NULL))
+    {
+        m_error = Error(ENOMEM);
+        m_failed = true;
+        return false;
+    }
+
+    job->split = m_split;
+
+    if (m_split ? !blocks(job, end) : !streams(end, open))
+    {
+        delete job;
+        return false;
+    }
+
+    restSize = m_pendingSize - end;
+
+    if (restSize == 0)
+        rest = NULL;
+    else if (UNLIKELY((rest = static_cast<unsigned char *>(::malloc(restSize + ReadSize))) == NULL))
+    {
+        delete job;
+        m_error = Error(ENOMEM);
+        m_failed = true;
+        return false;
+    }
+    else
+        ::memcpy(rest, m_pending + end, restSize);
+
+    job->owner = this;
+    job->in = m_pending;
+    job->inSize = job->split ? (job->last + 7) / 8 : end;
+    job->out = NULL;
+    job->outSize = 0;
+    job->outCapacity = 0;
+    job->consumed = 0;
+    job->from = m_link;
+    job->to = NULL;
+    job->done = false;
+    job->failed = false;
+
+    m_link = NULL;
+    m_pending = rest;
+    m_pendingSize = restSize;
+    m_pendingCapacity = rest ? restSize + ReadSize : 0;
+
+    if (open)
+    {
+        if (UNLIKELY((m_link = new (std::nothrow) Link) == NULL))
+        {
+            m_error = Error(ENOMEM);
+            m_failed = true;
+        }
+        else
+        {
+            m_link->stream = NULL;
+            m_link->ready = false;
+            m_link->failed = false;
+            job->to = m_link;
+        }
+    }
+
+    enqueue(job);
+    return true;
+}
+
+bool Bzip2Stream::blocks(Job *job, size_t &end)
+{
+    uint64_t bit = m_shift;
+    uint64_t next = 0;
+    uint64_t from;
+    size_t size;
+    bool last = false;
+    bool found;
+
+    while (m_header)
+    {
+        while (m_pendingSize < HeaderSize && fill())
+            continue;
+
+        /* Anything but another stream after the end is trailing garbage. */
+        if (m_pendingSize < HeaderSize || !isStreamHeader(m_pending))
+        {
+            if (m_launched == 0)
+            {
+                m_error = Error(EIO);
+                m_failed = true;
+            }
+
+            m_pendingSize = 0;
+            m_eof = true;
+            return false;
+        }
+
+        m_level = m_pending[3];
+
+        /* Empty stream. */
+        if (peek(m_pending, 32, 16) == (EndMagic >> 32) && peek(m_pending, 48, 32) == (EndMagic & 0xFFFFFFFF))
+        {
+            end = (32 + MagicBits + CrcBits + 7) / 8;
+
+            while (m_pendingSize < end && fill())
+                continue;
+
+            m_pendingSize -= m_pendingSize < end ? m_pendingSize : end;
+            ::memmove(m_pending, m_pending + end, m_pendingSize);
+            continue;
+        }
+
+        m_header = false;
+        bit = 32;
+    }
+
+    job->level = m_level;
+    job->first = bit;
+    job->crc = 0;
+
+    for (;;)
+    {
+        while (8 * m_pendingSize < bit + MagicBits + CrcBits && fill())
+            continue;
+
+        /* Data cut short is left to the job, which fails on it. */
+        if (8 * m_pendingSize < bit + MagicBits + CrcBits)
+        {
+            next = 8 * m_pendingSize;
+            last = false;
+            break;
+        }
+
+        job->crc = ((job->crc << 1) | (job->crc >> 31)) ^ peek(m_pending, bit + MagicBits, CrcBits);
+
+        for (from = bit + MagicBits + CrcBits; !(found = find(m_pending, m_pendingSize, from, next, last));)
+        {
+            size = m_pendingSize;
+
+            if (size - job->first / 8 >= MaxJobSize || !fill())
+                break;
+
+            if (8 * size - MagicBits + 1 > from)
+                from = 8 * size - MagicBits + 1;
+        }
+
+        if (!found)
+        {
+            next = 8 * m_pendingSize;
+            last = false;
+            break;
+        }
+
+        if (last || next - job->first >= 8 * static_cast<uint64_t>(JobSize))
+            break;
+
+        bit = next;
+    }
+
+    job->last = next;
+
+    if (last)
+    {
+        /* Next stream starts at the byte after the CRC of this one. */
+        end = (next + MagicBits + CrcBits + 7) / 8;
+
+        while (m_pendingSize < end && fill())
+            continue;
+
+        if (end > m_pendingSize)
+            end = m_pendingSize;
+
+        m_header = true;
+        m_shift = 0;
+    }
+    else
+    {
+        end = next / 8;
+        m_shift = next % 8;
+    }
+
+    return true;
+}
+
+bool Bzip2Stream::streams(size_t &end, bool &open)
+{
+    size_t from = JobSize;
+
+    for (;;)
+    {
+        if (from > m_pendingSize)
+            from = m_pendingSize;
+
+        if ((end = boundary(from)) != 0)
+            break;
+
+        if (m_eof)
+        {
+            end = m_pendingSize;
+            break;
+        }
+
+        if (m_pendingSize >= MaxJobSize)
+        {
+            end = MaxJobSize;
+            open = true;
+            break;
+        }
+
+        if (m_pendingSize >= HeaderSize)
+            from = m_pendingSize - HeaderSize + 1;
+
+        fill();
+    }
+
+    return true;
+}
+
+void Bzip2Stream::enqueue(Job *job)
+{
+    bool started;
+
+    __atomic_add_fetch(&m_memory, job->inSize, __ATOMIC_RELAXED);
+
+    ::pthread_mutex_lock(&m_mutex);
+    m_jobs[(m_first + m_count++) % MaxJobs] = job;
+    ++m_launched;
+
+    /* Workers are started as jobs wait for them, one per core at most. */
+    if (m_idle == 0 && m_workerCount < m_window - 1 &&
+        ::pthread_create(&m_workers[m_workerCount], NULL, worker, this) == 0)
+    {
+        ++m_workerCount;
+    }
+
+    if ((started = m_workerCount == 0))
+        ++m_started;
+    else
+        ::pthread_cond_broadcast(&m_cond);
+
+    ::pthread_mutex_unlock(&m_mutex);
+
+    /* No thread could be started, the job is done right here. */
+    if (started)
+        decompress(job);
+}
+
+size_t Bzip2Stream::boundary(size_t from) const
+{
+    const unsigned char *data;
+
+    if (from == 0)
+        from = 1;
+
+    if (m_pendingSize < HeaderSize)
+        return 0;
+
+    for (size_t last = m_pendingSize - HeaderSize; from <= last; from = data - m_pending + 1)
+    {
+        if ((data = static_cast<const unsigned char *>(::memchr(m_pending + from, 'B', last - from + 1))) == NULL)
+            break;
+
+        if (isHeader(data))
+            return data - m_pending;
+    }
+
+    return 0;
+}
+
+bool Bzip2Stream::fill()
+{
+    unsigned char *pending;
+    size_t res;
+
+    if (m_eof)
+        return false;
+
+    if (m_pendingCapacity - m_pendingSize < ReadSize)
+    {
+        size_t capacity = m_pendingCapacity * 2 + ReadSize;
+
+        if (UNLIKELY((pending = static_cast<unsigned char *>(::realloc(m_pending, capacity))) == NULL))
+        {
+            m_error = Error(ENOMEM);
+            m_failed = true;
+            m_eof = true;
+            return false;
+        }
+
+        m_pending = pending;
+        m_pendingCapacity = capacity;
+    }
+
+    if ((res = m_file->read(m_pending + m_pendingSize, ReadSize)) == 0)
+    {
+        m_eof = true;
+        return false;
+    }
+
+    m_pendingSize += res;
+    return true;
+}
+
+void Bzip2Stream::clear()
+{
+    Job *job;
+
+    ::pthread_mutex_lock(&m_mutex);
+    __atomic_store_n(&m_abort, true, __ATOMIC_RELAXED);
+    ::pthread_cond_broadcast(&m_cond);
+
+    for (unsigned int i = 0; i < m_count; ++i)
+        while (!m_jobs[(m_first + i) % MaxJobs]->done)
+            ::pthread_cond_wait(&m_cond, &m_mutex);
+
+    __atomic_store_n(&m_abort, false, __ATOMIC_RELAXED);
+    m_launched = 0;
+    m_started = 0;
+    ::pthread_mutex_unlock(&m_mutex);
+
+    for (; m_count > 0; --m_count, m_first = (m_first + 1) % MaxJobs)
+    {
+        job = m_jobs[m_first];
+        ::free(job->in);
+        ::free(job->out);
+
+        if (job->from)
+        {
+            destroy(job->from->stream);
+            delete job->from;
+        }
+
+        delete job;
+    }
+
+    if (m_link)
+    {
+        destroy(m_link->stream);
+        delete m_link;
+        m_link = NULL;
+    }
+
+    ::free(m_pending);
+    m_pending = NULL;
+    m_pendingSize = 0;
+    m_pendingCapacity = 0;
+    m_first = 0;
+    m_memory = 0;
+    m_header = true;
+    m_shift = 0;
+}
+
+bool Bzip2Stream::restart()
+{
+    clear();
+
+    m_eof = false;
+    m_failed = false;
+    m_out = 0;
+
+    if (!m_file->seek(0, static_cast<IStream::Whence>(SEEK_SET)))
+    {
+        m_error = Error(EIO);
+        m_failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+bool Bzip2Stream::skip(int64_t size)
+{
+    char buffer[BufferSize];
+    size_t res;
+
+    for (; size > 0; size -= res)
+        if ((res = read(buffer, size < BufferSize ? size : BufferSize)) == 0)
+            return false;
+
+    return true;
+}
+
+}}}
@@ -0,0 +1,125 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LVFS_ARC_LIBARCHIVE_BZIP2STREAM_H_
+#define LVFS_ARC_LIBARCHIVE_BZIP2STREAM_H_
+
+#include <lvfs/IStream>
+#include <pthread.h>
+#include <stdint.h>
+
+
+namespace LVFS {
+namespace Arc {
+namespace LibArchive {
+
+/**
+ * Decompressed view of a bzip2 file.
+ *
+ * Compressed data is cut into jobs of about JobSize bytes at block magics,
+ * which are not byte aligned (as pbzip2 and lbzip2 do for files made by
+ * bzip2). Every job is wrapped into a stream of its own, decompressed by
+ * one of a fixed set of workers and output is returned in order. No job
+ * is started while the ones in flight hold MaxMemory of input and output.
+ *
+ * Block magic may also show up inside compressed data. A job which fails
+ * makes the stream decompress again from the start with jobs cut at byte
+ * aligned stream headers only (pbzip2 and concatenated files), where a job
+ * without one within MaxJobSize bytes continues the stream of the previous
+ * one and waits for it.
+ */
+class PLATFORM_MAKE_PRIVATE Bzip2Stream : public Implements<IStream>
+{
+public:
+    enum
+    {
+        BufferSize = 65536,
+        ReadSize = 1024 * 1024,
+        JobSize = 4 * 1024 * 1024,
+        MaxJobSize = 32 * 1024 * 1024,
+        MaxJobs = 64,
+        MaxMemory = 256 * 1024 * 1024
+    };
+
+public:
+    Bzip2Stream(const Interface::Holder &file);
+    virtual ~Bzip2Stream();
+
+    static bool isBzip2(const unsigned char *header, size_t size);
+
+public: /* IStream */
+    virtual size_t read(void *buffer, size_t size);
+    virtual size_t write(const void *buffer, size_t size);
+    virtual bool advise(off_t offset, off_t len, Advise advise);
+    virtual bool seek(long offset, Whence whence);
+    virtual bool flush();
+
+    virtual const Error &lastError() const;
+
+private:
+    struct Link;
+    struct Job;
+
+    static void *worker(void *self);
+    void decompress(Job *job);
+    bool assemble(Job *job);
+
+    bool launch();
+    bool blocks(Job *job, size_t &end);
+    bool streams(size_t &end, bool &open);
+    void enqueue(Job *job);
+    size_t boundary(size_t from) const;
+    bool fill();
+    void clear();
+    bool restart();
+    bool skip(int64_t size);
+
+private:
+    Interface::Adaptor<IStream> m_file;
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+    bool m_abort;
+    bool m_stop;
+    pthread_t m_workers[MaxJobs];
+    unsigned int m_workerCount;
+    unsigned int m_idle;
+    Job *m_jobs[MaxJobs];
+    unsigned int m_window;
+    unsigned int m_first;
+    unsigned int m_count;
+    unsigned int m_launched;
+    unsigned int m_started;
+    bool m_split;
+    bool m_header;
+    char m_level;
+    unsigned int m_shift;
+    size_t m_memory;
+    Link *m_link;
+    unsigned char *m_pending;
+    size_t m_pendingSize;
+    size_t m_pendingCapacity;
+    bool m_eof;
+    bool m_failed;
+    int64_t m_out;
+    mutable Error m_error;
+};
+
+}}}
+
+#endif /* LVFS_ARC_LIBARCHIVE_BZIP2STREAM_H_ */
@@ -0,0 +1,441 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lvfs_arc_libarchive_GzipStream.h"
+
+#include <brolly/assert.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace LVFS {
+namespace Arc {
+namespace LibArchive {
+
+namespace {
+    enum
+    {
+        /* Window bits for auto-detection of the gzip header. */
+        GzipWindowBits = 15 + 32,
+        RawWindowBits = -15,
+        TrailerSize = 8
+    };
+}
+
+
+GzipIndex::GzipIndex() :
+    m_points(NULL),
+    m_count(0),
+    m_capacity(0),
+    m_complete(false),
+    m_size(0)
+{
+    ::pthread_mutex_init(&m_mutex, NULL);
+}
+
+GzipIndex::~GzipIndex()
+{
+    for (uint32_t i = 0; i < m_count; ++i)
+        ::free(m_points[i].window);
+
+    ::free(m_points);
+    ::pthread_mutex_destroy(&m_mutex);
+}
+
+bool GzipIndex::isGzip(const unsigned char *header, size_t size)
+{
+    return size >= 3 && header[0] == 0x1f && header[1] == 0x8b && header[2] == 8;
+}
+
+bool GzipIndex::size(int64_t &size) const
+{
+    bool res;
+
+    ::pthread_mutex_lock(&m_mutex);
+    size = m_size;
+    res = m_complete;
+    ::pthread_mutex_unlock(&m_mutex);
+
+    return res;
+}
+
+int64_t GzipIndex::frontier() const
+{
+    int64_t res;
+
+    ::pthread_mutex_lock(&m_mutex);
+    res = m_count ? m_points[m_count - 1].out : 0;
+    ::pthread_mutex_unlock(&m_mutex);
+
+    return res;
+}
+
+bool GzipIndex::find(int64_t offset, Point &point) const
+{
+    uint32_t lo = 0;
+    uint32_t hi;
+
+    ::pthread_mutex_lock(&m_mutex);
+
+    for (hi = m_count; lo < hi;)
+    {
+        uint32_t mid = (lo + hi) / 2;
+
+        if (m_points[mid].out <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    /* Windows are never freed before the index, so a copy stays valid. */
+    if (lo)
+        point = m_points[lo - 1];
+
+    ::pthread_mutex_unlock(&m_mutex);
+    return lo != 0;
+}
+
+bool GzipIndex::add(int64_t out, int64_t in, int bits, const unsigned char *window, uInt windowSize)
+{
+    Point point;
+
+    point.out = out;
+    point.in = in;
+    point.bits = bits;
+    point.windowSize = 0;
+    point.window = NULL;
+
+    if (windowSize > 0)
+    {
+        uLongf size = ::compressBound(windowSize);
+
+        if (UNLIKELY((point.window = static_cast<unsigned char *>(::malloc(size))) == NULL))
+            return false;
+
+        if (::compress2(point.window, &size, window, windowSize, Z_BEST_SPEED) != Z_OK)
+        {
+            ::free(point.window);
+            return false;
+        }
+
+        point.windowSize = size;
+    }
+
+    ::pthread_mutex_lock(&m_mutex);
+
+    /* Another reader could have got here first. */
+    if (m_count > 0 && out <= m_points[m_count - 1].out)
+    {
+        ::pthread_mutex_unlock(&m_mutex);
+        ::free(point.window);
+        return false;
+    }
+
+    if (m_count == m_capacity)
+    {
+        Point *points = static_cast<Point *>(::realloc(m_points, (m_capacity * 2 + 64) * sizeof(Point)));
+
+        if (UNLIKELY(points == NULL))
+        {
+            ::pthread_mutex_unlock(&m_mutex);
+            ::free(point.window);
+            return false;
+        }
+
+        m_points = points;
+        m_capacity = m_capacity * 2 + 64;
+    }
+
+    m_points[m_count++] = point;
+    ::pthread_mutex_unlock(&m_mutex);
+
+    return true;
+}
+
+void GzipIndex::complete(int64_t size)
+{
+    ::pthread_mutex_lock(&m_mutex);
+    m_complete = true;
+    m_size = size;
+    ::pthread_mutex_unlock(&m_mutex);
+}
+
+
+GzipStream::GzipStream(const Interface::Holder &file, const GzipIndex::Holder &index) :
+    m_file(file),
+    m_index(index),
+    m_initialized(false),
+    m_raw(false),
+    m_eof(false),
+    m_in(0),
+    m_out(0)
+{
+    ASSERT(m_file.isValid());
+    ASSERT(m_index.isValid());
+    ::memset(&m_stream, 0, sizeof(m_stream));
+    m_initialized = ::inflateInit2(&m_stream, GzipWindowBits) == Z_OK;
+}
+
+GzipStream::~GzipStream()
+{
+    if (m_initialized)
+        ::inflateEnd(&m_stream);
+}
+
+size_t GzipStream::read(void *buffer, size_t size)
+{
+    unsigned char window[GzipIndex::WindowSize];
+    int64_t start = m_out;
+    bool boundary = false;
+    uInt windowSize;
+    int res;
+
+    if (UNLIKELY(!m_initialized))
+    {
+        m_error = Error(EIO);
+        return 0;
+    }
+
+    m_stream.next_out = static_cast<Bytef *>(buffer);
+    m_stream.avail_out = size;
+
+    while (m_stream.avail_out > 0 && !m_eof)
+    {
+        if (m_stream.avail_in == 0 && !fill())
+        {
+            if (!boundary)
+                m_error = Error(EIO);
+
+            m_eof = true;
+            break;
+        }
+
+        res = ::inflate(&m_stream, Z_BLOCK);
+        m_out = start + (size - m_stream.avail_out);
+
+        if (res == Z_STREAM_END)
+        {
+            if (m_raw)
+            {
+                /* Restarted in the middle of a member, trailer is left to us. */
+                for (int i = 0; i < TrailerSize; ++i, ++m_stream.next_in, --m_stream.avail_in)
+                    if (m_stream.avail_in == 0 && !fill())
+                        break;
+
+                ::inflateReset2(&m_stream, GzipWindowBits);
+                m_raw = false;
+            }
+            else
+                ::inflateReset(&m_stream);
+
+            boundary = true;
+
+            if (m_stream.avail_in == 0 && !fill())
+            {
+                m_eof = true;
+
+                if (m_out >= m_index->frontier())
+                    m_index->complete(m_out);
+
+                break;
+            }
+
+            if (m_out - m_index->frontier() >= GzipIndex::Span)
+                m_index->add(m_out, m_in - m_stream.avail_in, -1, NULL, 0);
+
+            continue;
+        }
+        else if (res != Z_OK && res != Z_BUF_ERROR)
+        {
+            /* Zero padding after the last member is not an error. */
+            if (!boundary)
+                m_error = Error(EIO);
+            else if (m_out >= m_index->frontier())
+                m_index->complete(m_out);
+
+            m_eof = true;
+            break;
+        }
+
+        if (m_out > start)
+            boundary = false;
+
+        if ((m_stream.data_type & 128) && !(m_stream.data_type & 64) &&
+            m_out - m_index->frontier() >= GzipIndex::Span)
+        {
+            windowSize = sizeof(window);
+
+            if (::inflateGetDictionary(&m_stream, window, &windowSize) == Z_OK)
+                m_index->add(m_out, m_in - m_stream.avail_in, m_stream.data_type & 7, window, windowSize);
+        }
+    }
+
+    return m_out - start;
+}
+
+size_t GzipStream::write(const void *buffer, size_t size)
+{
+    m_error = Error(EROFS);
+    return 0;
+}
+
+bool GzipStream::advise(off_t offset, off_t len, Advise advise)
+{
+    m_error = Error(EROFS);
+    return false;
+}
+
+bool GzipStream::seek(long offset, Whence whence)
+{
+    GzipIndex::Point point;
+    bool found;
+    int64_t target;
+
+    switch (whence)
+    {
+        case SEEK_SET:
+            target = offset;
+            break;
+
+        case SEEK_CUR:
+            target = m_out + offset;
+            break;
+
+        default:
+            if (!m_index->size(target))
+            {
+                m_error = Error(ESPIPE);
+                return false;
+            }
+
+            target += offset;
+            break;
+    }
+
+    if (target < 0)
+    {
+        m_error = Error(EINVAL);
+        return false;
+    }
+
+    found = m_index->find(target, point);
+
+    if (target < m_out || (found && point.out > m_out))
+        if (!restart(found ? &point : NULL))
+            return false;
+
+    return skip(target - m_out);
+}
+
+bool GzipStream::flush()
+{
+    m_error = Error(EROFS);
+    return false;
+}
+
+const Error &GzipStream::lastError() const
+{
+    return m_error;
+}
+
+bool GzipStream::restart(const GzipIndex::Point *point)
+{
+    int64_t in = point ? point->in : 0;
+
+    if (m_initialized)
+        ::inflateEnd(&m_stream);
+
+    ::memset(&m_stream, 0, sizeof(m_stream));
+    m_eof = false;
+    m_out = point ? point->out : 0;
+
+    if (point == NULL || point->bits < 0)
+    {
+        m_raw = false;
+        m_initialized = ::inflateInit2(&m_stream, GzipWindowBits) == Z_OK;
+    }
+    else
+    {
+        m_raw = true;
+        m_initialized = ::inflateInit2(&m_stream, RawWindowBits) == Z_OK;
+
+        if (point->bits)
+            --in;
+    }
+
+    if (UNLIKELY(!m_initialized) || !m_file->seek(in, static_cast<IStream::Whence>(SEEK_SET)))
+    {
+        m_error = Error(EIO);
+        return false;
+    }
+
+    m_in = in;
+
+    if (m_raw)
+    {
+        unsigned char window[GzipIndex::WindowSize];
+        uLongf windowSize = sizeof(window);
+
+        if (point->bits)
+        {
+            if (!fill())
+                return false;
+
+            ::inflatePrime(&m_stream, point->bits, m_stream.next_in[0] >> (8 - point->bits));
+            ++m_stream.next_in;
+            --m_stream.avail_in;
+        }
+
+        if (::uncompress(window, &windowSize, point->window, point->windowSize) != Z_OK ||
+            ::inflateSetDictionary(&m_stream, window, windowSize) != Z_OK)
+        {
+            m_error = Error(EIO);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool GzipStream::skip(int64_t size)
+{
+    unsigned char buffer[BufferSize];
+    size_t res;
+
+    for (; size > 0; size -= res)
+        if ((res = read(buffer, size < BufferSize ? size : BufferSize)) == 0)
+            return false;
+
+    return true;
+}
+
+bool GzipStream::fill()
+{
+    size_t res = m_file->read(m_buffer, BufferSize);
+
+    m_stream.next_in = m_buffer;
+    m_stream.avail_in = res;
+    m_in += res;
+
+    return res > 0;
+}
+
+}}}
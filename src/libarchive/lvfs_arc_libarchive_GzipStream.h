@@ -0,0 +1,128 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LVFS_ARC_LIBARCHIVE_GZIPSTREAM_H_
+#define LVFS_ARC_LIBARCHIVE_GZIPSTREAM_H_
+
+#include <efc/Holder>
+#include <lvfs/IStream>
+#include <pthread.h>
+#include <zlib.h>
+
+
+namespace LVFS {
+namespace Arc {
+namespace LibArchive {
+
+/**
+ * Checkpoints of a gzip stream.
+ *
+ * Every Span bytes of uncompressed output the state of the decompressor
+ * (position in the compressed stream, bit offset and the last 32K of
+ * output) is saved, so decompression can be restarted from there.
+ * Index is filled by GzipStream while data is read for the first time
+ * and is shared by all readers of the archive.
+ */
+class PLATFORM_MAKE_PRIVATE GzipIndex : public ::EFC::Holder<GzipIndex>::Data
+{
+    PLATFORM_MAKE_NONCOPYABLE(GzipIndex)
+
+public:
+    typedef ::EFC::Holder<GzipIndex> Holder;
+
+    enum
+    {
+        Span = 4 * 1024 * 1024,
+        WindowSize = 32768
+    };
+
+    struct Point
+    {
+        int64_t out;
+        int64_t in;
+        int bits;
+        uLong windowSize;
+        unsigned char *window;
+    };
+
+public:
+    GzipIndex();
+    virtual ~GzipIndex();
+
+    static bool isGzip(const unsigned char *header, size_t size);
+
+    bool size(int64_t &size) const;
+    int64_t frontier() const;
+
+    bool find(int64_t offset, Point &point) const;
+    bool add(int64_t out, int64_t in, int bits, const unsigned char *window, uInt windowSize);
+    void complete(int64_t size);
+
+private:
+    mutable pthread_mutex_t m_mutex;
+    Point *m_points;
+    uint32_t m_count;
+    uint32_t m_capacity;
+    bool m_complete;
+    int64_t m_size;
+};
+
+
+/**
+ * Decompressed view of a gzip file with random access.
+ */
+class PLATFORM_MAKE_PRIVATE GzipStream : public Implements<IStream>
+{
+public:
+    enum { BufferSize = 65536 };
+
+public:
+    GzipStream(const Interface::Holder &file, const GzipIndex::Holder &index);
+    virtual ~GzipStream();
+
+public: /* IStream */
+    virtual size_t read(void *buffer, size_t size);
+    virtual size_t write(const void *buffer, size_t size);
+    virtual bool advise(off_t offset, off_t len, Advise advise);
+    virtual bool seek(long offset, Whence whence);
+    virtual bool flush();
+
+    virtual const Error &lastError() const;
+
+private:
+    bool restart(const GzipIndex::Point *point);
+    bool skip(int64_t size);
+    bool fill();
+
+private:
+    Interface::Adaptor<IStream> m_file;
+    GzipIndex::Holder m_index;
+    z_stream m_stream;
+    bool m_initialized;
+    bool m_raw;
+    bool m_eof;
+    int64_t m_in;
+    int64_t m_out;
+    mutable Error m_error;
+    unsigned char m_buffer[BufferSize];
+};
+
+}}}
+
+#endif /* LVFS_ARC_LIBARCHIVE_GZIPSTREAM_H_ */
@@ -0,0 +1,80 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lvfs_arc_libarchive_MappedFile.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstring>
+
+
+namespace LVFS {
+namespace Arc {
+namespace LibArchive {
+
+MappedFile::MappedFile(const IEntry *file) :
+    m_data(NULL),
+    m_size(0)
+{
+    struct stat st;
+    void *data;
+    int fd;
+
+    if (::strcmp(file->schema(), "file") != 0 || (fd = ::open(file->location(), O_RDONLY | O_CLOEXEC)) == -1)
+        return;
+
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        static_cast<off_t>(static_cast<size_t>(st.st_size)) == st.st_size)
+    {
+        if ((data = ::mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED)
+        {
+            m_data = static_cast<unsigned char *>(data);
+            m_size = st.st_size;
+        }
+    }
+
+    ::close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data != NULL)
+        ::munmap(m_data, m_size);
+}
+
+void MappedFile::advise(int64_t offset, int64_t size, Advice advice) const
+{
+    static const int advices[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED };
+    long page = ::sysconf(_SC_PAGESIZE);
+    int64_t start;
+
+    if (m_data == NULL || offset >= m_size)
+        return;
+
+    if (size > m_size - offset)
+        size = m_size - offset;
+
+    /* madvise(2) wants a page aligned address. */
+    start = offset - offset % page;
+    ::madvise(m_data + start, size + (offset - start), advices[advice]);
+}
+
+}}}
@@ -0,0 +1,71 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LVFS_ARC_LIBARCHIVE_MAPPEDFILE_H_
+#define LVFS_ARC_LIBARCHIVE_MAPPEDFILE_H_
+
+#include <efc/Holder>
+#include <lvfs/IEntry>
+#include <stdint.h>
+
+
+namespace LVFS {
+namespace Arc {
+namespace LibArchive {
+
+/**
+ * Read-only mapping of a local archive file.
+ *
+ * Blocks of the mapping are handed to libarchive as they are, so compressed
+ * data is never copied. Files which can not be mapped (not local, not
+ * regular or empty) are left to the buffered IStream path.
+ */
+class PLATFORM_MAKE_PRIVATE MappedFile : public ::EFC::Holder<MappedFile>::Data
+{
+    PLATFORM_MAKE_NONCOPYABLE(MappedFile)
+
+public:
+    typedef ::EFC::Holder<MappedFile> Holder;
+
+    enum Advice
+    {
+        Normal,
+        Sequential,
+        Random,
+        WillNeed
+    };
+
+public:
+    MappedFile(const IEntry *file);
+    virtual ~MappedFile();
+
+    inline bool isValid() const { return m_data != NULL; }
+    inline const unsigned char *data() const { return m_data; }
+    inline int64_t size() const { return m_size; }
+
+    void advise(int64_t offset, int64_t size, Advice advice) const;
+
+private:
+    unsigned char *m_data;
+    int64_t m_size;
+};
+
+}}}
+
+#endif /* LVFS_ARC_LIBARCHIVE_MAPPEDFILE_H_ */
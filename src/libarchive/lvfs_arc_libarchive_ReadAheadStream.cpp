@@ -0,0 +1,327 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lvfs_arc_libarchive_ReadAheadStream.h"
+
+#include <brolly/assert.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace LVFS {
+namespace Arc {
+namespace LibArchive {
+
+ReadAheadStream::ReadAheadStream(const Interface::Holder &source, uint32_t blocks) :
+    m_source(source),
+    m_running(false),
+    m_stop(false),
+    m_eof(false),
+    m_blocks(NULL),
+    m_count(blocks < MaxBlocks ? blocks : MaxBlocks),
+    m_head(0),
+    m_filled(0),
+    m_offset(0),
+    m_streamed(0),
+    m_advised(false)
+{
+    ASSERT(m_source.isValid());
+    ::pthread_mutex_init(&m_mutex, NULL);
+    ::pthread_cond_init(&m_condition, NULL);
+}
+
+ReadAheadStream::~ReadAheadStream()
+{
+    if (m_running)
+        stop();
+
+    if (m_blocks != NULL)
+    {
+        for (uint32_t i = 0; i < m_count; ++i)
+            ::free(m_blocks[i].data);
+
+        ::free(m_blocks);
+    }
+
+    ::pthread_cond_destroy(&m_condition);
+    ::pthread_mutex_destroy(&m_mutex);
+}
+
+uint32_t ReadAheadStream::blocks()
+{
+    const char *value = ::getenv("LVFS_ARC_READAHEAD");
+    unsigned long res;
+
+    if (value == NULL || *value == 0)
+        return DefaultBlocks;
+
+    res = ::strtoul(value, NULL, 10);
+    return res < MaxBlocks ? res : MaxBlocks;
+}
+
+size_t ReadAheadStream::read(void *buffer, size_t size)
+{
+    size_t res;
+
+    /* Only long sequential reads are worth a thread. */
+    if (!m_running && (m_streamed < BlockSize || !start()))
+    {
+        if ((res = m_source->read(buffer, size)) == 0)
+            m_error = m_source->lastError();
+
+        m_streamed += res;
+        return res;
+    }
+
+    return consume(buffer, size);
+}
+
+size_t ReadAheadStream::write(const void *buffer, size_t size)
+{
+    m_error = Error(EROFS);
+    return 0;
+}
+
+bool ReadAheadStream::advise(off_t offset, off_t len, Advise advise)
+{
+    if (!m_running)
+        return m_source->advise(offset, len, advise);
+
+    /* Source belongs to the worker while it runs, the worker passes the advice on. */
+    ::pthread_mutex_lock(&m_mutex);
+    m_advice.offset = offset;
+    m_advice.len = len;
+    m_advice.advise = advise;
+    m_advised = true;
+    ::pthread_mutex_unlock(&m_mutex);
+
+    return true;
+}
+
+bool ReadAheadStream::seek(long offset, Whence whence)
+{
+    bool forward = whence == FromCurrent && offset >= 0;
+    long skipped = 0;
+
+    if (m_running)
+    {
+        if (forward && offset <= static_cast<long>(m_count) * BlockSize &&
+            (skipped = consume(NULL, offset)) == offset)
+        {
+            return true;
+        }
+
+        stop();
+
+        /*
+         * Source is ahead of the reader by everything not consumed yet. A skip
+         * cut short by the end consumed all of it, the rest is left to the source.
+         */
+        if (skipped > 0)
+            offset -= skipped;
+        else if (whence == FromCurrent)
+        {
+            for (uint32_t i = 0; i < m_filled; ++i)
+                offset -= m_blocks[(m_head + i) % m_count].size;
+
+            offset += m_offset;
+        }
+
+        m_head = 0;
+        m_filled = 0;
+        m_offset = 0;
+        m_eof = false;
+    }
+
+    if (!forward)
+        m_streamed = 0;
+
+    if (m_source->seek(offset, whence))
+        return true;
+
+    m_error = m_source->lastError();
+
+    /* Failed seek leaves the position where it was before the skip. */
+    if (skipped > 0)
+        m_source->seek(-skipped, FromCurrent);
+
+    return false;
+}
+
+bool ReadAheadStream::flush()
+{
+    m_error = Error(EROFS);
+    return false;
+}
+
+const Error &ReadAheadStream::lastError() const
+{
+    return m_error;
+}
+
+void *ReadAheadStream::worker(void *arg)
+{
+    ReadAheadStream *self = static_cast<ReadAheadStream *>(arg);
+
+    ::pthread_mutex_lock(&self->m_mutex);
+
+    for (;;)
+    {
+        while (!self->m_stop && self->m_filled == self->m_count)
+            ::pthread_cond_wait(&self->m_condition, &self->m_mutex);
+
+        if (self->m_stop)
+            break;
+
+        /* Free blocks are not touched by the reader. */
+        Block &block = self->m_blocks[(self->m_head + self->m_filled) % self->m_count];
+        Advice advice = self->m_advice;
+        bool advised = self->m_advised;
+
+        self->m_advised = false;
+        ::pthread_mutex_unlock(&self->m_mutex);
+
+        if (advised)
+            self->apply(advice);
+
+        block.size = self->m_source->read(block.data, BlockSize);
+        ::pthread_mutex_lock(&self->m_mutex);
+
+        if (block.size == 0)
+        {
+            self->m_error = self->m_source->lastError();
+            self->m_eof = true;
+            ::pthread_cond_broadcast(&self->m_condition);
+            break;
+        }
+
+        ++self->m_filled;
+        ::pthread_cond_broadcast(&self->m_condition);
+    }
+
+    ::pthread_mutex_unlock(&self->m_mutex);
+    return NULL;
+}
+
+bool ReadAheadStream::start()
+{
+    ASSERT(!m_running);
+
+    if (m_count == 0)
+        return false;
+
+    if (m_blocks == NULL)
+    {
+        if (UNLIKELY((m_blocks = static_cast<Block *>(::calloc(m_count, sizeof(Block)))) == NULL))
+        {
+            m_count = 0;
+            return false;
+        }
+
+        for (uint32_t i = 0; i < m_count; ++i)
+            if (UNLIKELY((m_blocks[i].data = static_cast<unsigned char *>(::malloc(BlockSize))) == NULL))
+            {
+                for (; i > 0; --i)
+                    ::free(m_blocks[i - 1].data);
+
+                ::free(m_blocks);
+                m_blocks = NULL;
+                m_count = 0;
+                return false;
+            }
+    }
+
+    m_stop = false;
+
+    /* Without a thread the stream just stays synchronous. */
+    if (::pthread_create(&m_thread, NULL, worker, this) != 0)
+    {
+        m_streamed = 0;
+        return false;
+    }
+
+    return m_running = true;
+}
+
+void ReadAheadStream::stop()
+{
+    ASSERT(m_running);
+
+    ::pthread_mutex_lock(&m_mutex);
+    m_stop = true;
+    ::pthread_cond_broadcast(&m_condition);
+    ::pthread_mutex_unlock(&m_mutex);
+
+    ::pthread_join(m_thread, NULL);
+    m_running = false;
+
+    /* Advice the worker had no chance to pass on. */
+    if (m_advised)
+    {
+        m_advised = false;
+        apply(m_advice);
+    }
+}
+
+size_t ReadAheadStream::consume(void *buffer, size_t size)
+{
+    unsigned char *data = static_cast<unsigned char *>(buffer);
+    size_t res = 0;
+    size_t chunk;
+
+    ::pthread_mutex_lock(&m_mutex);
+
+    while (res < size)
+    {
+        /* Reads return what is there, skips (no buffer) wait for everything. */
+        while (m_filled == 0 && !m_eof && (res == 0 || data == NULL))
+            ::pthread_cond_wait(&m_condition, &m_mutex);
+
+        if (m_filled == 0)
+            break;
+
+        Block &block = m_blocks[m_head];
+        chunk = block.size - m_offset < size - res ? block.size - m_offset : size - res;
+
+        if (data != NULL)
+            ::memcpy(data + res, block.data + m_offset, chunk);
+
+        res += chunk;
+
+        if ((m_offset += chunk) == block.size)
+        {
+            m_head = (m_head + 1) % m_count;
+            m_offset = 0;
+            --m_filled;
+            ::pthread_cond_broadcast(&m_condition);
+        }
+    }
+
+    ::pthread_mutex_unlock(&m_mutex);
+    return res;
+}
+
+void ReadAheadStream::apply(const Advice &advice)
+{
+    m_source->advise(advice.offset, advice.len, advice.advise);
+}
+
+}}}
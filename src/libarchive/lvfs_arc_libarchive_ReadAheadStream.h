@@ -0,0 +1,108 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LVFS_ARC_LIBARCHIVE_READAHEADSTREAM_H_
+#define LVFS_ARC_LIBARCHIVE_READAHEADSTREAM_H_
+
+#include <lvfs/IStream>
+#include <pthread.h>
+#include <stdint.h>
+
+
+namespace LVFS {
+namespace Arc {
+namespace LibArchive {
+
+/**
+ * Source stream with read-ahead on a background thread.
+ *
+ * Once the stream has been read sequentially for a while, a thread keeps
+ * up to a given number of blocks filled ahead of the reader, so source I/O
+ * overlaps with decompression. Seeks stop the thread; forward seeks within
+ * the already read blocks are served from them.
+ *
+ * Number of blocks is taken from LVFS_ARC_READAHEAD, 0 disables read-ahead.
+ */
+class PLATFORM_MAKE_PRIVATE ReadAheadStream : public Implements<IStream>
+{
+public:
+    enum
+    {
+        BlockSize = 1024 * 1024,
+        DefaultBlocks = 4,
+        MaxBlocks = 64
+    };
+
+public:
+    ReadAheadStream(const Interface::Holder &source, uint32_t blocks);
+    virtual ~ReadAheadStream();
+
+    static uint32_t blocks();
+
+public: /* IStream */
+    virtual size_t read(void *buffer, size_t size);
+    virtual size_t write(const void *buffer, size_t size);
+    virtual bool advise(off_t offset, off_t len, Advise advise);
+    virtual bool seek(long offset, Whence whence);
+    virtual bool flush();
+
+    virtual const Error &lastError() const;
+
+private:
+    struct Block
+    {
+        unsigned char *data;
+        size_t size;
+    };
+
+    struct Advice
+    {
+        off_t offset;
+        off_t len;
+        Advise advise;
+    };
+
+    static void *worker(void *arg);
+    bool start();
+    void stop();
+    size_t consume(void *buffer, size_t size);
+    void apply(const Advice &advice);
+
+private:
+    Interface::Adaptor<IStream> m_source;
+    pthread_t m_thread;
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_condition;
+    bool m_running;
+    bool m_stop;
+    bool m_eof;
+    Block *m_blocks;
+    uint32_t m_count;
+    uint32_t m_head;
+    uint32_t m_filled;
+    size_t m_offset;
+    int64_t m_streamed;
+    Advice m_advice;
+    bool m_advised;
+    Error m_error;
+};
+
+}}}
+
+#endif /* LVFS_ARC_LIBARCHIVE_READAHEADSTREAM_H_ */
@@ -0,0 +1,772 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lvfs_arc_libarchive_SevenZipBlocks.h"
+
+#include <brolly/assert.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <lzma.h>
+
+
+namespace LVFS {
+namespace Arc {
+namespace LibArchive {
+
+namespace {
+    enum
+    {
+        SignatureHeaderSize = 32,
+        MaxHeaderSize = 64 * 1024 * 1024,
+        MaxCoders = 64,
+        MaxEncodings = 4
+    };
+
+    enum Property
+    {
+        EndProperty = 0x00,
+        HeaderProperty = 0x01,
+        ArchiveProperties = 0x02,
+        AdditionalStreamsInfo = 0x03,
+        MainStreamsInfo = 0x04,
+        FilesInfo = 0x05,
+        PackInfo = 0x06,
+        UnpackInfo = 0x07,
+        SubStreamsInfo = 0x08,
+        SizeProperty = 0x09,
+        CrcProperty = 0x0A,
+        FolderProperty = 0x0B,
+        CodersUnpackSize = 0x0C,
+        NumUnpackStream = 0x0D,
+        EmptyStream = 0x0E,
+        EmptyFile = 0x0F,
+        Attributes = 0x15,
+        EncodedHeader = 0x17
+    };
+
+    enum Method
+    {
+        CopyMethod = 0x00,
+        Lzma2Method = 0x21,
+        LzmaMethod = 0x030101
+    };
+
+    enum
+    {
+        DirectoryAttribute = 0x10,
+        UnixExtension = 0x8000
+    };
+
+    inline uint32_t le32(const unsigned char *p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    inline uint64_t le64(const unsigned char *p)
+    {
+        return static_cast<uint64_t>(le32(p)) | (static_cast<uint64_t>(le32(p + 4)) << 32);
+    }
+
+    bool readAt(IStream *stream, int64_t offset, void *buffer, size_t size)
+    {
+        size_t res;
+
+        if (!stream->seek(offset, static_cast<IStream::Whence>(SEEK_SET)))
+            return false;
+
+        for (char *p = static_cast<char *>(buffer); size > 0; p += res, size -= res)
+            if ((res = stream->read(p, size)) == 0)
+                return false;
+
+        return true;
+    }
+
+    /* Header data, any read past the end makes it invalid. */
+    class Cursor
+    {
+    public:
+        Cursor(const unsigned char *data, size_t size) :
+            m_data(data),
+            m_end(data + size),
+            m_valid(true)
+        {}
+
+        inline bool isValid() const { return m_valid; }
+        inline const unsigned char *data() const { return m_data; }
+        inline uint64_t left() const { return m_end - m_data; }
+
+        unsigned char byte()
+        {
+            if (UNLIKELY(m_data == m_end))
+            {
+                m_valid = false;
+                return EndProperty;
+            }
+
+            return *m_data++;
+        }
+
+        /* First byte tells by its leading ones how many bytes follow. */
+        uint64_t number()
+        {
+            unsigned char first = byte();
+            unsigned char mask = 0x80;
+            uint64_t res = 0;
+
+            for (int i = 0; i < 8; ++i, mask >>= 1)
+            {
+                if ((first & mask) == 0)
+                    return res | (static_cast<uint64_t>(first & (mask - 1)) << (8 * i));
+
+                res |= static_cast<uint64_t>(byte()) << (8 * i);
+            }
+
+            return res;
+        }
+
+        void skip(uint64_t size)
+        {
+            if (UNLIKELY(size > left()))
+            {
+                m_valid = false;
+                m_data = m_end;
+            }
+            else
+                m_data += size;
+        }
+
+        /* Vector of count bits, the highest bit of a byte first. */
+        void bits(uint64_t count, unsigned char *res)
+        {
+            unsigned char value = 0;
+
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                if ((i & 7) == 0)
+                    value = byte();
+
+                res[i] = (value >> (7 - (i & 7))) & 1;
+            }
+        }
+
+        /* Same, or all set if the leading byte says so. */
+        void defined(uint64_t count, unsigned char *res)
+        {
+            if (byte() == 0)
+                bits(count, res);
+            else
+                ::memset(res, 1, count);
+        }
+
+        /* Checksums of count items, defined tells which ones have them. */
+        void skipDigests(uint64_t count, unsigned char *defined = NULL)
+        {
+            unsigned char *vector = defined ? defined : static_cast<unsigned char *>(::malloc(count + 1));
+            uint64_t digests = 0;
+
+            if (UNLIKELY(vector == NULL))
+            {
+                m_valid = false;
+                return;
+            }
+
+            this->defined(count, vector);
+
+            for (uint64_t i = 0; i < count; ++i)
+                digests += vector[i];
+
+            if (vector != defined)
+                ::free(vector);
+
+            skip(digests * 4);
+        }
+
+    private:
+        const unsigned char *m_data;
+        const unsigned char *m_end;
+        bool m_valid;
+    };
+
+    /* Coders and streams of the archive, only what is needed to find blocks and decode the header. */
+    struct Streams
+    {
+        Streams() :
+            packPosition(0),
+            packSize(0),
+            folders(0),
+            outputs(NULL),
+            unpackStreams(NULL),
+            checked(NULL),
+            coders(0),
+            method(0),
+            properties(NULL),
+            propertiesSize(0),
+            unpackSize(0)
+        {}
+
+        ~Streams()
+        {
+            ::free(outputs);
+            ::free(unpackStreams);
+            ::free(checked);
+        }
+
+        uint64_t packPosition;
+        uint64_t packSize;
+        uint64_t folders;
+        uint64_t *outputs;
+        uint64_t *unpackStreams;
+        unsigned char *checked;
+
+        /* Of the first folder. */
+        uint64_t coders;
+        uint64_t method;
+        const unsigned char *properties;
+        uint64_t propertiesSize;
+        uint64_t unpackSize;
+    };
+
+    bool readPackInfo(Cursor &cursor, Streams &streams)
+    {
+        uint64_t count;
+        unsigned char type;
+
+        streams.packPosition = cursor.number();
+        count = cursor.number();
+
+        if (count > cursor.left())
+            return false;
+
+        while ((type = cursor.byte()) != EndProperty)
+            if (type == SizeProperty)
+                for (uint64_t i = 0; i < count; ++i)
+                    if (i == 0)
+                        streams.packSize = cursor.number();
+                    else
+                        cursor.number();
+            else if (type == CrcProperty)
+                cursor.skipDigests(count);
+            else
+                return false;
+
+        return cursor.isValid();
+    }
+
+    bool readFolder(Cursor &cursor, Streams &streams, uint64_t folder)
+    {
+        uint64_t coders = cursor.number();
+        uint64_t inputs = 0;
+        uint64_t outputs = 0;
+        uint64_t bindPairs;
+        uint64_t packed;
+
+        if (coders == 0 || coders > MaxCoders)
+            return false;
+
+        for (uint64_t i = 0; i < coders; ++i)
+        {
+            unsigned char flags = cursor.byte();
+            uint64_t method = 0;
+            uint64_t coderInputs = 1;
+            uint64_t coderOutputs = 1;
+            const unsigned char *properties = NULL;
+            uint64_t propertiesSize = 0;
+
+            /* Alternative methods were never written by anyone. */
+            if ((flags & 0x80) || (flags & 0x0F) > 8)
+                return false;
+
+            for (int j = flags & 0x0F; j > 0; --j)
+                method = (method << 8) | cursor.byte();
+
+            if (flags & 0x10)
+            {
+                coderInputs = cursor.number();
+                coderOutputs = cursor.number();
+
+                if (coderInputs > MaxCoders || coderOutputs > MaxCoders)
+                    return false;
+            }
+
+            if (flags & 0x20)
+            {
+                propertiesSize = cursor.number();
+                properties = cursor.data();
+                cursor.skip(propertiesSize);
+            }
+
+            if (folder == 0 && i == 0)
+            {
+                streams.coders = coders;
+                streams.method = method;
+                streams.properties = properties;
+                streams.propertiesSize = propertiesSize;
+            }
+
+            inputs += coderInputs;
+            outputs += coderOutputs;
+        }
+
+        if (outputs == 0)
+            return false;
+
+        bindPairs = outputs - 1;
+
+        for (uint64_t i = 0; i < bindPairs; ++i)
+        {
+            cursor.number();
+            cursor.number();
+        }
+
+        if (inputs < bindPairs)
+            return false;
+
+        if ((packed = inputs - bindPairs) > 1)
+            for (uint64_t i = 0; i < packed; ++i)
+                cursor.number();
+
+        streams.outputs[folder] = outputs;
+        return cursor.isValid();
+    }
+
+    bool readUnpackInfo(Cursor &cursor, Streams &streams)
+    {
+        unsigned char type;
+
+        if (cursor.byte() != FolderProperty)
+            return false;
+
+        /* Every folder takes a few bytes at least. */
+        if ((streams.folders = cursor.number()) > cursor.left() || cursor.byte() != 0)
+            return false;
+
+        streams.outputs = static_cast<uint64_t *>(::malloc((streams.folders + 1) * sizeof(uint64_t)));
+        streams.unpackStreams = static_cast<uint64_t *>(::malloc((streams.folders + 1) * sizeof(uint64_t)));
+        streams.checked = static_cast<unsigned char *>(::calloc(streams.folders + 1, 1));
+
+        if (UNLIKELY(streams.outputs == NULL || streams.unpackStreams == NULL || streams.checked == NULL))
+            return false;
+
+        for (uint64_t i = 0; i < streams.folders; ++i)
+        {
+            if (!readFolder(cursor, streams, i))
+                return false;
+
+            streams.unpackStreams[i] = 1;
+        }
+
+        if (cursor.byte() != CodersUnpackSize)
+            return false;
+
+        for (uint64_t i = 0; i < streams.folders; ++i)
+            for (uint64_t j = 0; j < streams.outputs[i]; ++j)
+                if (i == 0 && j == 0)
+                    streams.unpackSize = cursor.number();
+                else
+                    cursor.number();
+
+        while ((type = cursor.byte()) != EndProperty)
+            if (type == CrcProperty)
+                cursor.skipDigests(streams.folders, streams.checked);
+            else
+                return false;
+
+        return cursor.isValid();
+    }
+
+    bool readSubStreamsInfo(Cursor &cursor, Streams &streams)
+    {
+        unsigned char type = cursor.byte();
+        uint64_t digests = 0;
+
+        if (type == NumUnpackStream)
+        {
+            for (uint64_t i = 0; i < streams.folders; ++i)
+                if ((streams.unpackStreams[i] = cursor.number()) > cursor.left() * 8 + 1)
+                    return false;
+
+            type = cursor.byte();
+        }
+
+        if (type == SizeProperty)
+        {
+            for (uint64_t i = 0; i < streams.folders; ++i)
+                for (uint64_t j = 1; j < streams.unpackStreams[i]; ++j)
+                    cursor.number();
+
+            type = cursor.byte();
+        }
+
+        /* Streams which are whole folders have the checksum of their folder. */
+        for (uint64_t i = 0; i < streams.folders; ++i)
+            if (streams.unpackStreams[i] != 1 || !streams.checked[i])
+                digests += streams.unpackStreams[i];
+
+        for (; type != EndProperty; type = cursor.byte())
+            if (type == CrcProperty)
+                cursor.skipDigests(digests);
+            else
+                return false;
+
+        return cursor.isValid();
+    }
+
+    bool readStreams(Cursor &cursor, Streams &streams)
+    {
+        unsigned char type = cursor.byte();
+
+        if (type == PackInfo)
+        {
+            if (!readPackInfo(cursor, streams))
+                return false;
+
+            type = cursor.byte();
+        }
+
+        if (type == UnpackInfo)
+        {
+            if (!readUnpackInfo(cursor, streams))
+                return false;
+
+            type = cursor.byte();
+        }
+
+        if (type == SubStreamsInfo)
+        {
+            if (streams.folders == 0 || !readSubStreamsInfo(cursor, streams))
+                return false;
+
+            type = cursor.byte();
+        }
+
+        return type == EndProperty && cursor.isValid();
+    }
+
+    /* Packed header is one folder of one coder, 7-Zip and libarchive use LZMA for it. */
+    unsigned char *decode(IStream *stream, int64_t size, const Streams &streams, uint64_t &unpackSize)
+    {
+        int64_t offset = SignatureHeaderSize + streams.packPosition;
+        unsigned char *packed;
+        unsigned char *res = NULL;
+
+        if (streams.folders != 1 || streams.coders != 1 ||
+            streams.packSize == 0 || streams.packSize > MaxHeaderSize ||
+            streams.unpackSize == 0 || streams.unpackSize > MaxHeaderSize ||
+            offset + static_cast<int64_t>(streams.packSize) > size)
+        {
+            return NULL;
+        }
+
+        if (UNLIKELY((packed = static_cast<unsigned char *>(::malloc(streams.packSize))) == NULL))
+            return NULL;
+
+        if (readAt(stream, offset, packed, streams.packSize) &&
+            (res = static_cast<unsigned char *>(::malloc(streams.unpackSize))) != NULL)
+        {
+            if (streams.method == CopyMethod)
+            {
+                if (streams.packSize < streams.unpackSize)
+                {
+                    ::free(res);
+                    res = NULL;
+                }
+                else
+                    ::memcpy(res, packed, streams.unpackSize);
+            }
+            else
+            {
+                lzma_filter filters[2] = { { LZMA_FILTER_LZMA1, NULL }, { LZMA_VLI_UNKNOWN, NULL } };
+                lzma_stream lzma = LZMA_STREAM_INIT;
+                bool done = false;
+
+                if (streams.method == Lzma2Method)
+                    filters[0].id = LZMA_FILTER_LZMA2;
+
+                if ((streams.method == LzmaMethod || streams.method == Lzma2Method) &&
+                    ::lzma_properties_decode(&filters[0], NULL, streams.properties, streams.propertiesSize) == LZMA_OK)
+                {
+                    if (::lzma_raw_decoder(&lzma, filters) == LZMA_OK)
+                    {
+                        size_t left;
+                        lzma_ret ret;
+
+                        lzma.next_in = packed;
+                        lzma.avail_in = streams.packSize;
+                        lzma.next_out = res;
+                        lzma.avail_out = streams.unpackSize;
+
+                        /* LZMA streams of 7z have no end marker, decoding stops at the known size. */
+                        do
+                        {
+                            left = lzma.avail_out;
+                            ret = ::lzma_code(&lzma, LZMA_RUN);
+                        }
+                        while (ret == LZMA_OK && lzma.avail_out > 0 && lzma.avail_out != left);
+
+                        done = (ret == LZMA_OK || ret == LZMA_STREAM_END) && lzma.avail_out == 0;
+                        ::lzma_end(&lzma);
+                    }
+
+                    ::free(filters[0].options);
+                }
+
+                if (!done)
+                {
+                    ::free(res);
+                    res = NULL;
+                }
+            }
+        }
+
+        ::free(packed);
+        unpackSize = streams.unpackSize;
+
+        return res;
+    }
+}
+
+
+SevenZipBlocks::SevenZipBlocks() :
+    m_blocks(NULL),
+    m_count(0)
+{}
+
+SevenZipBlocks::~SevenZipBlocks()
+{
+    ::free(m_blocks);
+}
+
+bool SevenZipBlocks::isSevenZip(const unsigned char *header, size_t size)
+{
+    static const unsigned char magic[6] = { '7', 'z', 0xBC, 0xAF, 0x27, 0x1C };
+    return size >= sizeof(magic) && ::memcmp(header, magic, sizeof(magic)) == 0;
+}
+
+bool SevenZipBlocks::read(IStream *stream, int64_t size)
+{
+    ASSERT(m_blocks == NULL);
+    unsigned char signature[SignatureHeaderSize];
+    unsigned char *header;
+    uint64_t headerSize;
+    int64_t offset;
+    bool res = false;
+
+    if (size < SignatureHeaderSize || !readAt(stream, 0, signature, sizeof(signature)) ||
+        !isSevenZip(signature, sizeof(signature)))
+    {
+        return false;
+    }
+
+    offset = SignatureHeaderSize + le64(signature + 12);
+    headerSize = le64(signature + 20);
+
+    if (headerSize == 0 || headerSize > MaxHeaderSize || offset < SignatureHeaderSize ||
+        offset + static_cast<int64_t>(headerSize) > size ||
+        (header = static_cast<unsigned char *>(::malloc(headerSize))) == NULL)
+    {
+        return false;
+    }
+
+    if (readAt(stream, offset, header, headerSize))
+        for (int i = 0; i < MaxEncodings && header != NULL; ++i)
+        {
+            if (header[0] == HeaderProperty)
+            {
+                res = parse(header + 1, headerSize - 1);
+                break;
+            }
+            else if (header[0] == EncodedHeader)
+            {
+                Cursor cursor(header + 1, headerSize - 1);
+                Streams streams;
+                unsigned char *decoded = NULL;
+
+                if (readStreams(cursor, streams))
+                    decoded = decode(stream, size, streams, headerSize);
+
+                ::free(header);
+                header = decoded;
+            }
+            else
+                break;
+        }
+
+    ::free(header);
+    return res;
+}
+
+bool SevenZipBlocks::parse(const unsigned char *data, size_t size)
+{
+    Cursor cursor(data, size);
+    Streams streams;
+    unsigned char type = cursor.byte();
+    unsigned char *empty = NULL;
+    unsigned char *emptyFiles = NULL;
+    unsigned char *hasAttributes = NULL;
+    uint32_t *attributes = NULL;
+    uint64_t files = 0;
+    uint64_t folder = 0;
+    uint64_t streamsLeft;
+    bool res = false;
+
+    if (type == ArchiveProperties)
+    {
+        while (cursor.byte() != EndProperty && cursor.isValid())
+            cursor.skip(cursor.number());
+
+        type = cursor.byte();
+    }
+
+    if (type == AdditionalStreamsInfo)
+    {
+        Streams additional;
+
+        if (!readStreams(cursor, additional))
+            return false;
+
+        type = cursor.byte();
+    }
+
+    if (type == MainStreamsInfo)
+    {
+        if (!readStreams(cursor, streams))
+            return false;
+
+        type = cursor.byte();
+    }
+
+    if (type != FilesInfo || (files = cursor.number()) > cursor.left() || files >= None)
+        return false;
+
+    empty = static_cast<unsigned char *>(::calloc(files + 1, 1));
+    emptyFiles = static_cast<unsigned char *>(::calloc(files + 1, 1));
+    hasAttributes = static_cast<unsigned char *>(::calloc(files + 1, 1));
+    attributes = static_cast<uint32_t *>(::calloc(files + 1, sizeof(uint32_t)));
+    m_blocks = static_cast<uint32_t *>(::malloc((files + 1) * sizeof(uint32_t)));
+
+    if (LIKELY(empty != NULL && emptyFiles != NULL && hasAttributes != NULL && attributes != NULL && m_blocks != NULL))
+    {
+        uint64_t emptyCount = 0;
+
+        while ((type = cursor.byte()) != EndProperty && cursor.isValid())
+        {
+            uint64_t propertySize = cursor.number();
+
+            if (propertySize > cursor.left())
+                break;
+
+            Cursor property(cursor.data(), propertySize);
+            cursor.skip(propertySize);
+
+            switch (type)
+            {
+                case EmptyStream:
+                    property.bits(files, empty);
+
+                    for (uint64_t i = 0; i < files; ++i)
+                        emptyCount += empty[i];
+                    break;
+
+                case EmptyFile:
+                    property.bits(emptyCount, emptyFiles);
+                    break;
+
+                case Attributes:
+                    property.defined(files, hasAttributes);
+
+                    /* External flag, attributes are right here. */
+                    if (property.byte() == 0)
+                        for (uint64_t i = 0; i < files; ++i)
+                            if (hasAttributes[i])
+                            {
+                                const unsigned char *p = property.data();
+                                property.skip(4);
+
+                                if (property.isValid())
+                                    attributes[i] = le32(p);
+                            }
+                    break;
+
+                default:
+                    break;
+            }
+        }
+
+        if (cursor.isValid())
+        {
+            res = true;
+            streamsLeft = streams.folders ? streams.unpackStreams[0] : 0;
+
+            for (uint64_t i = 0, j = 0; i < files; ++i)
+            {
+                bool directory;
+
+                if (hasAttributes[i] && (attributes[i] & UnixExtension))
+                    directory = S_ISDIR(attributes[i] >> 16);
+                else
+                    directory = (hasAttributes[i] && (attributes[i] & DirectoryAttribute)) || (empty[i] && !emptyFiles[j]);
+
+                if (empty[i])
+                    ++j;
+
+                /* The reader does not stop at directories, so neither do indexes. */
+                if (directory)
+                    continue;
+
+                if (empty[i])
+                {
+                    m_blocks[m_count++] = None;
+                    continue;
+                }
+
+                while (folder < streams.folders && streamsLeft == 0)
+                    if (++folder < streams.folders)
+                        streamsLeft = streams.unpackStreams[folder];
+
+                if (folder == streams.folders)
+                {
+                    res = false;
+                    break;
+                }
+
+                --streamsLeft;
+                m_blocks[m_count++] = streams.unpackStreams[folder] > 1 ? static_cast<uint32_t>(folder) : None;
+            }
+        }
+    }
+
+    ::free(empty);
+    ::free(emptyFiles);
+    ::free(hasAttributes);
+    ::free(attributes);
+
+    if (!res)
+    {
+        ::free(m_blocks);
+        m_blocks = NULL;
+        m_count = 0;
+    }
+
+    return res;
+}
+
+}}}
@@ -0,0 +1,68 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LVFS_ARC_LIBARCHIVE_SEVENZIPBLOCKS_H_
+#define LVFS_ARC_LIBARCHIVE_SEVENZIPBLOCKS_H_
+
+#include <efc/Holder>
+#include <lvfs/IStream>
+#include <stdint.h>
+
+
+namespace LVFS {
+namespace Arc {
+namespace LibArchive {
+
+/**
+ * Solid blocks (folders) of a 7z file.
+ *
+ * Only the header is read (and decoded if it is packed with LZMA or LZMA2).
+ * Entries are numbered the way the reader goes through them, that is
+ * directories are left out.
+ */
+class PLATFORM_MAKE_PRIVATE SevenZipBlocks : public ::EFC::Holder<SevenZipBlocks>::Data
+{
+    PLATFORM_MAKE_NONCOPYABLE(SevenZipBlocks)
+
+public:
+    typedef ::EFC::Holder<SevenZipBlocks> Holder;
+    enum { None = 0xFFFFFFFF };
+
+public:
+    SevenZipBlocks();
+    virtual ~SevenZipBlocks();
+
+    bool read(IStream *stream, int64_t size);
+
+    static bool isSevenZip(const unsigned char *header, size_t size);
+
+    /* Block of an entry, None if the entry has no data or is the only one in its block. */
+    inline uint32_t block(uint32_t index) const { return index < m_count ? m_blocks[index] : None; }
+
+private:
+    bool parse(const unsigned char *data, size_t size);
+
+private:
+    uint32_t *m_blocks;
+    uint32_t m_count;
+};
+
+}}}
+
+#endif /* LVFS_ARC_LIBARCHIVE_SEVENZIPBLOCKS_H_ */
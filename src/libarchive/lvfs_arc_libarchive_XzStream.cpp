@@ -0,0 +1,212 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lvfs_arc_libarchive_XzStream.h"
+
+#include <brolly/assert.h>
+
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+
+namespace LVFS {
+namespace Arc {
+namespace LibArchive {
+
+XzStream::XzStream(const Interface::Holder &file) :
+    m_file(file),
+    m_initialized(false),
+    m_eof(false),
+    m_finish(false),
+    m_out(0)
+{
+    ASSERT(m_file.isValid());
+    restart();
+}
+
+XzStream::~XzStream()
+{
+    if (m_initialized)
+        ::lzma_end(&m_stream);
+}
+
+bool XzStream::isXz(const unsigned char *header, size_t size)
+{
+    static const unsigned char magic[6] = { 0xFD, '7', 'z', 'X', 'Z', 0 };
+    return size >= sizeof(magic) && ::memcmp(header, magic, sizeof(magic)) == 0;
+}
+
+size_t XzStream::read(void *buffer, size_t size)
+{
+    size_t res;
+    lzma_ret ret;
+
+    if (UNLIKELY(!m_initialized))
+    {
+        m_error = Error(EIO);
+        return 0;
+    }
+
+    m_stream.next_out = static_cast<uint8_t *>(buffer);
+    m_stream.avail_out = size;
+
+    while (m_stream.avail_out > 0 && !m_eof)
+    {
+        if (m_stream.avail_in == 0 && !m_finish)
+        {
+            m_stream.next_in = m_buffer;
+
+            if ((m_stream.avail_in = m_file->read(m_buffer, BufferSize)) == 0)
+                m_finish = true;
+        }
+
+        ret = ::lzma_code(&m_stream, m_finish ? LZMA_FINISH : LZMA_RUN);
+
+        if (ret == LZMA_STREAM_END)
+            m_eof = true;
+        else if (ret != LZMA_OK)
+        {
+            m_error = Error(EIO);
+            m_eof = true;
+        }
+    }
+
+    res = size - m_stream.avail_out;
+    m_out += res;
+
+    return res;
+}
+
+size_t XzStream::write(const void *buffer, size_t size)
+{
+    m_error = Error(EROFS);
+    return 0;
+}
+
+bool XzStream::advise(off_t offset, off_t len, Advise advise)
+{
+    m_error = Error(EROFS);
+    return false;
+}
+
+bool XzStream::seek(long offset, Whence whence)
+{
+    int64_t target;
+
+    switch (whence)
+    {
+        case SEEK_SET:
+            target = offset;
+            break;
+
+        case SEEK_CUR:
+            target = m_out + offset;
+            break;
+
+        default:
+            m_error = Error(ESPIPE);
+            return false;
+    }
+
+    if (target < 0)
+    {
+        m_error = Error(EINVAL);
+        return false;
+    }
+
+    if (target < m_out && !restart())
+        return false;
+
+    return skip(target - m_out);
+}
+
+bool XzStream::flush()
+{
+    m_error = Error(EROFS);
+    return false;
+}
+
+const Error &XzStream::lastError() const
+{
+    return m_error;
+}
+
+bool XzStream::restart()
+{
+#if LZMA_VERSION >= 50040002
+    lzma_mt mt;
+    long cpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t memory = ::lzma_physmem() / 4;
+#endif
+
+    if (m_initialized)
+        ::lzma_end(&m_stream);
+
+    ::memset(&m_stream, 0, sizeof(m_stream));
+
+    m_eof = false;
+    m_finish = false;
+    m_out = 0;
+
+    if (m_initialized && !m_file->seek(0, static_cast<IStream::Whence>(SEEK_SET)))
+    {
+        m_initialized = false;
+        m_error = Error(EIO);
+        return false;
+    }
+
+    m_initialized = false;
+
+#if LZMA_VERSION >= 50040002
+    ::memset(&mt, 0, sizeof(mt));
+
+    mt.flags = LZMA_CONCATENATED;
+    mt.threads = cpus > 1 ? cpus : 1;
+    mt.timeout = 0;
+    mt.memlimit_threading = memory < MaxMemory ? memory : MaxMemory;
+    mt.memlimit_stop = UINT64_MAX;
+
+    if (!(m_initialized = ::lzma_stream_decoder_mt(&m_stream, &mt) == LZMA_OK))
+    {
+        ::lzma_end(&m_stream);
+        ::memset(&m_stream, 0, sizeof(m_stream));
+    }
+#endif
+
+    /* Without the threaded decoder (liblzma before 5.4) blocks are decoded one by one. */
+    if (!m_initialized && !(m_initialized = ::lzma_stream_decoder(&m_stream, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK))
+        m_error = Error(ENOMEM);
+
+    return m_initialized;
+}
+
+bool XzStream::skip(int64_t size)
+{
+    uint8_t buffer[65536];
+    size_t res;
+
+    for (; size > 0; size -= res)
+        if ((res = read(buffer, size < static_cast<int64_t>(sizeof(buffer)) ? size : sizeof(buffer))) == 0)
+            return false;
+
+    return true;
+}
+
+}}}
@@ -0,0 +1,79 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LVFS_ARC_LIBARCHIVE_XZSTREAM_H_
+#define LVFS_ARC_LIBARCHIVE_XZSTREAM_H_
+
+#include <lvfs/IStream>
+#include <lzma.h>
+
+
+namespace LVFS {
+namespace Arc {
+namespace LibArchive {
+
+/**
+ * Decompressed view of a xz file.
+ *
+ * Blocks of multi-block files (xz -T) are decoded on all cores by the
+ * threaded liblzma decoder, which takes at most MaxMemory per stream.
+ * Seeking backwards restarts decompression.
+ */
+class PLATFORM_MAKE_PRIVATE XzStream : public Implements<IStream>
+{
+public:
+    enum
+    {
+        BufferSize = 1024 * 1024,
+        MaxMemory = 256 * 1024 * 1024
+    };
+
+public:
+    XzStream(const Interface::Holder &file);
+    virtual ~XzStream();
+
+    static bool isXz(const unsigned char *header, size_t size);
+
+public: /* IStream */
+    virtual size_t read(void *buffer, size_t size);
+    virtual size_t write(const void *buffer, size_t size);
+    virtual bool advise(off_t offset, off_t len, Advise advise);
+    virtual bool seek(long offset, Whence whence);
+    virtual bool flush();
+
+    virtual const Error &lastError() const;
+
+private:
+    bool restart();
+    bool skip(int64_t size);
+
+private:
+    Interface::Adaptor<IStream> m_file;
+    lzma_stream m_stream;
+    bool m_initialized;
+    bool m_eof;
+    bool m_finish;
+    int64_t m_out;
+    mutable Error m_error;
+    uint8_t m_buffer[BufferSize];
+};
+
+}}}
+
+#endif /* LVFS_ARC_LIBARCHIVE_XZSTREAM_H_ */
@@ -0,0 +1,323 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lvfs_arc_libarchive_ZipDirectory.h"
+
+#include <brolly/assert.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace LVFS {
+namespace Arc {
+namespace LibArchive {
+
+namespace {
+    enum
+    {
+        EndOfDirectorySize = 22,
+        EndOfDirectorySignature = 0x06054b50,
+        Zip64LocatorSize = 20,
+        Zip64LocatorSignature = 0x07064b50,
+        Zip64EndOfDirectorySize = 56,
+        Zip64EndOfDirectorySignature = 0x06064b50,
+        DirectoryHeaderSize = 46,
+        DirectoryHeaderSignature = 0x02014b50,
+        LocalHeaderSize = 30,
+        LocalHeaderSignature = 0x04034b50,
+        EncryptedFlag = 0x0001,
+        StoredMethod = 0,
+        Zip64ExtraField = 0x0001,
+        TimestampExtraField = 0x5455,
+        UnixHost = 3,
+        MaxCommentSize = 65535,
+        MaxDirectorySize = 512 * 1024 * 1024
+    };
+
+    inline uint16_t le16(const unsigned char *p)
+    {
+        return p[0] | (p[1] << 8);
+    }
+
+    inline uint32_t le32(const unsigned char *p)
+    {
+        return static_cast<uint32_t>(le16(p)) | (static_cast<uint32_t>(le16(p + 2)) << 16);
+    }
+
+    inline uint64_t le64(const unsigned char *p)
+    {
+        return static_cast<uint64_t>(le32(p)) | (static_cast<uint64_t>(le32(p + 4)) << 32);
+    }
+
+    bool readAt(IStream *stream, int64_t offset, void *buffer, size_t size)
+    {
+        size_t res;
+
+        if (!stream->seek(offset, static_cast<IStream::Whence>(SEEK_SET)))
+            return false;
+
+        for (char *p = static_cast<char *>(buffer); size > 0; p += res, size -= res)
+            if ((res = stream->read(p, size)) == 0)
+                return false;
+
+        return true;
+    }
+
+    /* Same as libarchive does for headers without a timestamp field. */
+    time_t dosTime(uint32_t value)
+    {
+        uint16_t time = value & 0xFFFF;
+        uint16_t date = value >> 16;
+        struct tm tm;
+
+        ::memset(&tm, 0, sizeof(tm));
+        tm.tm_year = ((date >> 9) & 0x7f) + 80;
+        tm.tm_mon = ((date >> 5) & 0x0f) - 1;
+        tm.tm_mday = date & 0x1f;
+        tm.tm_hour = (time >> 11) & 0x1f;
+        tm.tm_min = (time >> 5) & 0x3f;
+        tm.tm_sec = (time << 1) & 0x3e;
+        tm.tm_isdst = -1;
+
+        return ::mktime(&tm);
+    }
+
+    int compare(const void *e1, const void *e2)
+    {
+        int64_t offset1 = (*static_cast<const ZipDirectory::Entry * const *>(e1))->offset;
+        int64_t offset2 = (*static_cast<const ZipDirectory::Entry * const *>(e2))->offset;
+
+        return offset1 < offset2 ? -1 : offset1 > offset2 ? 1 : 0;
+    }
+}
+
+
+ZipDirectory::ZipDirectory() :
+    m_entries(NULL),
+    m_count(0),
+    m_ordered(NULL),
+    m_strings(NULL)
+{}
+
+ZipDirectory::~ZipDirectory()
+{
+    ::free(m_entries);
+    ::free(m_ordered);
+    ::free(m_strings);
+}
+
+bool ZipDirectory::isZip(const unsigned char *header, size_t size)
+{
+    return size >= 4 && header[0] == 'P' && header[1] == 'K' &&
+           ((header[2] == 3 && header[3] == 4) || (header[2] == 5 && header[3] == 6));
+}
+
+bool ZipDirectory::read(IStream *stream, int64_t size)
+{
+    ASSERT(m_entries == NULL);
+    unsigned char tail[EndOfDirectorySize + MaxCommentSize + Zip64LocatorSize];
+    size_t tailSize = size < static_cast<int64_t>(sizeof(tail)) ? size : sizeof(tail);
+    int64_t tailOffset = size - tailSize;
+    const unsigned char *eocd = NULL;
+    uint64_t count;
+    uint64_t directorySize;
+    uint64_t directoryOffset;
+    int64_t directoryEnd;
+    int64_t base;
+
+    if (tailSize < EndOfDirectorySize || !readAt(stream, tailOffset, tail, tailSize))
+        return false;
+
+    for (const unsigned char *p = tail + tailSize - EndOfDirectorySize; p >= tail; --p)
+        if (le32(p) == EndOfDirectorySignature && p + EndOfDirectorySize + le16(p + 20) <= tail + tailSize)
+        {
+            eocd = p;
+            break;
+        }
+
+    if (eocd == NULL || le16(eocd + 4) != 0 || le16(eocd + 6) != 0)
+        return false;
+
+    count = le16(eocd + 10);
+    directorySize = le32(eocd + 12);
+    directoryOffset = le32(eocd + 16);
+    directoryEnd = tailOffset + (eocd - tail);
+
+    if ((count == 0xFFFF || directorySize == 0xFFFFFFFF || directoryOffset == 0xFFFFFFFF) &&
+        eocd - tail >= Zip64LocatorSize && le32(eocd - Zip64LocatorSize) == Zip64LocatorSignature)
+    {
+        unsigned char eocd64[Zip64EndOfDirectorySize];
+        int64_t offset = le64(eocd - Zip64LocatorSize + 8);
+
+        if (!readAt(stream, offset, eocd64, sizeof(eocd64)) || le32(eocd64) != Zip64EndOfDirectorySignature)
+            return false;
+
+        count = le64(eocd64 + 32);
+        directorySize = le64(eocd64 + 40);
+        directoryOffset = le64(eocd64 + 48);
+        directoryEnd = offset;
+    }
+
+    /* Data prepended to the archive (self-extracting stubs) shifts every offset. */
+    base = directoryEnd - static_cast<int64_t>(directorySize) - static_cast<int64_t>(directoryOffset);
+
+    if (base < 0 || directorySize > MaxDirectorySize || count > directorySize / DirectoryHeaderSize)
+        return false;
+
+    unsigned char *directory = static_cast<unsigned char *>(::malloc(directorySize + 1));
+    bool res = false;
+
+    if (LIKELY(directory != NULL))
+    {
+        if (readAt(stream, base + directoryOffset, directory, directorySize))
+            res = parse(directory, directorySize, count, base);
+
+        ::free(directory);
+    }
+
+    return res;
+}
+
+int64_t ZipDirectory::stored(const Entry &entry, const unsigned char *file, int64_t size)
+{
+    const unsigned char *header = file + entry.offset;
+    int64_t res;
+
+    if (entry.method != StoredMethod || (entry.flags & EncryptedFlag) || entry.compressedSize != entry.size ||
+        entry.offset < 0 || entry.offset + LocalHeaderSize > size || le32(header) != LocalHeaderSignature)
+    {
+        return -1;
+    }
+
+    /* Name and extra field of the local header may differ from the central directory. */
+    res = entry.offset + LocalHeaderSize + le16(header + 26) + le16(header + 28);
+
+    return res + entry.size <= size ? res : -1;
+}
+
+uint32_t ZipDirectory::position(int64_t offset) const
+{
+    Entry key;
+    const Entry *keyPtr = &key;
+    const Entry **res;
+
+    key.offset = offset;
+    res = static_cast<const Entry **>(::bsearch(&keyPtr, m_ordered, m_count, sizeof(const Entry *), compare));
+
+    return res ? res - m_ordered : m_count;
+}
+
+bool ZipDirectory::parse(const unsigned char *data, size_t size, uint64_t count, int64_t base)
+{
+    const unsigned char *p = data;
+    const unsigned char *end = data + size;
+    char *string;
+
+    m_entries = static_cast<Entry *>(::malloc((count + 1) * sizeof(Entry)));
+    m_ordered = static_cast<const Entry **>(::malloc((count + 1) * sizeof(const Entry *)));
+    m_strings = static_cast<char *>(::malloc(size));
+
+    if (UNLIKELY(m_entries == NULL || m_ordered == NULL || m_strings == NULL))
+        return false;
+
+    for (string = m_strings; m_count < count; ++m_count)
+    {
+        Entry &entry = m_entries[m_count];
+        uint16_t nameSize;
+        uint16_t extraSize;
+        const unsigned char *extra;
+
+        if (p + DirectoryHeaderSize > end || le32(p) != DirectoryHeaderSignature)
+            return false;
+
+        nameSize = le16(p + 28);
+        extraSize = le16(p + 30);
+
+        if (p + DirectoryHeaderSize + nameSize + extraSize + le16(p + 32) > end)
+            return false;
+
+        entry.madeBy = le16(p + 4);
+        entry.flags = le16(p + 8);
+        entry.method = le16(p + 10);
+        entry.dosTime = le32(p + 12);
+        entry.compressedSize = le32(p + 20);
+        entry.size = le32(p + 24);
+        entry.attributes = le32(p + 38);
+        entry.offset = le32(p + 42);
+        entry.mTime = dosTime(entry.dosTime);
+
+        /* Mode of files added on Unix is in the high word, otherwise only the read-only bit is known. */
+        if ((entry.madeBy >> 8) == UnixHost && (entry.attributes >> 16) != 0)
+            entry.perm = (entry.attributes >> 16) & 07777;
+        else
+            entry.perm = (entry.attributes & 1) ? 0444 : 0664;
+
+        extra = p + DirectoryHeaderSize + nameSize;
+
+        for (const unsigned char *e = extra; e + 4 <= extra + extraSize; e += 4 + le16(e + 2))
+        {
+            const unsigned char *field = e + 4;
+            const unsigned char *fieldEnd = field + le16(e + 2);
+
+            if (fieldEnd > extra + extraSize)
+                break;
+
+            if (le16(e) == Zip64ExtraField)
+            {
+                if (entry.size == 0xFFFFFFFF && field + 8 <= fieldEnd)
+                {
+                    entry.size = le64(field);
+                    field += 8;
+                }
+
+                if (entry.compressedSize == 0xFFFFFFFF && field + 8 <= fieldEnd)
+                {
+                    entry.compressedSize = le64(field);
+                    field += 8;
+                }
+
+                if (entry.offset == 0xFFFFFFFF && field + 8 <= fieldEnd)
+                    entry.offset = le64(field);
+            }
+            else if (le16(e) == TimestampExtraField)
+            {
+                /* Central directory copy carries the modification time only. */
+                if (field + 5 <= fieldEnd && (field[0] & 1))
+                    entry.mTime = static_cast<int32_t>(le32(field + 1));
+            }
+        }
+
+        entry.offset += base;
+
+        ::memcpy(string, p + DirectoryHeaderSize, nameSize);
+        string[nameSize] = 0;
+        entry.path = string;
+        string += nameSize + 1;
+
+        m_ordered[m_count] = &entry;
+        p += DirectoryHeaderSize + nameSize + extraSize + le16(p + 32);
+    }
+
+    ::qsort(m_ordered, m_count, sizeof(const Entry *), compare);
+    return true;
+}
+
+}}}
@@ -0,0 +1,96 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LVFS_ARC_LIBARCHIVE_ZIPDIRECTORY_H_
+#define LVFS_ARC_LIBARCHIVE_ZIPDIRECTORY_H_
+
+#include <efc/Holder>
+#include <lvfs/IStream>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+
+namespace LVFS {
+namespace Arc {
+namespace LibArchive {
+
+/**
+ * Central directory of a zip file.
+ *
+ * Only the end of central directory record (and its zip64 counterpart)
+ * and the central directory itself are read, local headers are not touched.
+ */
+class PLATFORM_MAKE_PRIVATE ZipDirectory : public ::EFC::Holder<ZipDirectory>::Data
+{
+    PLATFORM_MAKE_NONCOPYABLE(ZipDirectory)
+
+public:
+    typedef ::EFC::Holder<ZipDirectory> Holder;
+
+    struct Entry
+    {
+        const char *path;
+        int64_t offset;
+        int64_t compressedSize;
+        int64_t size;
+        uint16_t method;
+        uint16_t flags;
+        uint16_t madeBy;
+        uint32_t dosTime;
+        uint32_t attributes;
+        time_t mTime;
+        mode_t perm;
+    };
+
+public:
+    ZipDirectory();
+    virtual ~ZipDirectory();
+
+    bool read(IStream *stream, int64_t size);
+
+    static bool isZip(const unsigned char *header, size_t size);
+
+    /* Offset of data of an entry stored without compression and encryption, -1 otherwise. */
+    static int64_t stored(const Entry &entry, const unsigned char *file, int64_t size);
+
+    inline uint32_t count() const { return m_count; }
+    inline const Entry &entry(uint32_t index) const { return m_entries[index]; }
+
+    /*
+     * Entries in the order of their local headers, the order libarchive
+     * reads them in. Position of the entry with the local header at the
+     * offset, count() if there is none.
+     */
+    inline const Entry *ordered(uint32_t position) const { return position < m_count ? m_ordered[position] : NULL; }
+    uint32_t position(int64_t offset) const;
+
+private:
+    bool parse(const unsigned char *data, size_t size, uint64_t count, int64_t base);
+
+private:
+    Entry *m_entries;
+    uint32_t m_count;
+    const Entry **m_ordered;
+    char *m_strings;
+};
+
+}}}
+
+#endif /* LVFS_ARC_LIBARCHIVE_ZIPDIRECTORY_H_ */
@@ -21,6 +21,10 @@
 
 #include <brolly/assert.h>
 
+#include <pthread.h>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
 #include <wchar.h>
 #include <libunrar/rar.hpp>
 #include <libunrar/dll.hpp>
@@ -32,13 +36,33 @@ namespace Arc {
 namespace LibUnrar {
 
 namespace {
+    /*
+     * Entries are extracted by RARProcessFile() on a worker thread, which
+     * pushes UCM_PROCESSDATA chunks into a bounded ring read by read().
+     */
     class ArchiveReader : public Archive::Reader
     {
+    public:
+        enum { RingSize = 4 * 1024 * 1024 };
+
+        enum State
+        {
+            Streaming,
+            Draining,
+            Aborting
+        };
+
     public:
         ArchiveReader(const Interface::Holder &file, const char *password) :
             Reader(file, password),
             m_archive(NULL),
-            m_tmpFile(NULL)
+            m_started(false),
+            m_done(false),
+            m_state(Streaming),
+            m_result(ERAR_SUCCESS),
+            m_ring(NULL),
+            m_head(0),
+            m_used(0)
         {
             ::memset(&m_archiveData, 0, sizeof(m_archiveData));
             ::memset(&m_archiveInfo, 0, sizeof(m_archiveInfo));
@@ -47,11 +71,23 @@ namespace {
             m_archiveData.OpenMode = RAR_OM_EXTRACT;
             m_archiveData.Callback = unrarcallback;
             m_archiveData.UserData = reinterpret_cast<LPARAM>(this);
+
+            ::pthread_mutex_init(&m_mutex, NULL);
+            ::pthread_cond_init(&m_condition, NULL);
         }
 
         virtual ~ArchiveReader()
         {
             close();
+
+            ::free(m_ring);
+            ::pthread_cond_destroy(&m_condition);
+            ::pthread_mutex_destroy(&m_mutex);
+        }
+
+        virtual Reader *clone() const
+        {
+            return new (std::nothrow) ArchiveReader(file(), password());
         }
 
         virtual bool isOpen() const
@@ -78,29 +114,56 @@ namespace {
 
         virtual size_t read(void *buffer, size_t size)
         {
-            int res = 0;
+            size_t res;
+            size_t chunk;
+            int error;
 
-            if (m_tmpFile)
-                return ::fread(buffer, 1, size, m_tmpFile);
-            else
-                if ((m_tmpFile = ::tmpfile()) && (res = RARProcessFile(m_archive, RAR_EXTRACT, NULL, NULL, true)) == 0)
-                {
-                    ::fseek(m_tmpFile, 0, SEEK_SET);
-                    return ::fread(buffer, 1, size, m_tmpFile);
-                }
+            if (!m_started && (error = start()) != 0)
+            {
+                setError(error);
+                return 0;
+            }
 
-            return 0;
+            ::pthread_mutex_lock(&m_mutex);
+
+            while (m_used == 0 && !m_done)
+                ::pthread_cond_wait(&m_condition, &m_mutex);
+
+            /* Bad checksum or password shows up only when the whole entry is through. */
+            if (m_used == 0 && m_result != ERAR_SUCCESS)
+            {
+                ::pthread_mutex_unlock(&m_mutex);
+                setError(EIO);
+                return 0;
+            }
+
+            res = m_used < size ? m_used : size;
+            chunk = RingSize - m_head < res ? RingSize - m_head : res;
+
+            ::memcpy(buffer, m_ring + m_head, chunk);
+            ::memcpy(static_cast<char *>(buffer) + chunk, m_ring, res - chunk);
+
+            m_head = (m_head + res) % RingSize;
+            m_used -= res;
+
+            ::pthread_cond_broadcast(&m_condition);
+            ::pthread_mutex_unlock(&m_mutex);
+
+            return res;
         }
 
-        virtual void close()
+        virtual bool seek(int64_t offset)
         {
-            if (m_tmpFile)
-                ::fclose(m_tmpFile);
+            /* Stream goes forward only, entry is re-located to go back. */
+            return false;
+        }
 
+        virtual void close()
+        {
+            stop(Aborting);
             RARCloseArchive(m_archive);
 
             m_archive = NULL;
-            m_tmpFile = NULL;
 
             ::memset(&m_archiveInfo, 0, sizeof(m_archiveInfo));
         }
@@ -108,18 +171,31 @@ namespace {
         virtual bool next()
         {
             if (m_archiveInfo.FileName[0] != 0)
-                if (m_tmpFile)
-                {
-                    ::fclose(m_tmpFile);
-                    m_tmpFile = NULL;
-                }
+                if (m_started)
+                    stop(Draining);
                 else
                     RARProcessFile(m_archive, RAR_SKIP, NULL, NULL);
 
-            if (RARReadHeaderEx(m_archive, &m_archiveInfo) == 0)
-                return true;
+            switch (RARReadHeaderEx(m_archive, &m_archiveInfo))
+            {
+                case ERAR_SUCCESS:
+                    setError(0);
+                    return true;
 
-            return false;
+                case ERAR_END_ARCHIVE:
+                    setError(0);
+                    return false;
+
+                default:
+                    setError(EIO);
+                    return false;
+            }
+        }
+
+        virtual uint32_t block(uint32_t index) const
+        {
+            /* Solid archive is one stream, every entry continues the previous one. */
+            return (m_archiveData.Flags & ROADF_SOLID) ? 0 : NoBlock;
         }
 
         virtual const char *archive_entry_pathname() const
@@ -158,6 +234,67 @@ namespace {
             return PLATFORM_MAKE_QWORD(m_archiveInfo.UnpSizeHigh, m_archiveInfo.UnpSize);
         }
 
+        virtual int64_t archive_entry_offset() const
+        {
+            ASSERT(m_archive != NULL);
+            return -1;
+        }
+
+    private:
+        /* Starts the decoding thread, returns 0 or the error it failed with. */
+        int start()
+        {
+            int res;
+
+            ASSERT(!m_started);
+
+            if (m_ring == NULL && (m_ring = static_cast<unsigned char *>(::malloc(RingSize))) == NULL)
+                return ENOMEM;
+
+            m_done = false;
+            m_state = Streaming;
+            m_result = ERAR_SUCCESS;
+            m_head = 0;
+            m_used = 0;
+
+            if ((res = ::pthread_create(&m_thread, NULL, worker, this)) == 0)
+                m_started = true;
+
+            return res;
+        }
+
+        void stop(State state)
+        {
+            if (!m_started)
+                return;
+
+            ::pthread_mutex_lock(&m_mutex);
+            m_state = state;
+            ::pthread_cond_broadcast(&m_condition);
+            ::pthread_mutex_unlock(&m_mutex);
+
+            ::pthread_join(m_thread, NULL);
+            m_started = false;
+
+            /* Position in the archive is unknown after an interrupted extraction. */
+            if (m_result != ERAR_SUCCESS)
+                setIndex(NoIndex);
+        }
+
+        static void *worker(void *arg)
+        {
+            ArchiveReader *self = static_cast<ArchiveReader *>(arg);
+            int res = RARProcessFile(self->m_archive, RAR_EXTRACT, NULL, NULL, true);
+
+            ::pthread_mutex_lock(&self->m_mutex);
+            self->m_result = res;
+            self->m_done = true;
+            ::pthread_cond_broadcast(&self->m_condition);
+            ::pthread_mutex_unlock(&self->m_mutex);
+
+            return NULL;
+        }
+
     private:
         static int CALLBACK unrarcallback(UINT msg, LPARAM userData, LPARAM p1, LPARAM p2)
         {
@@ -167,10 +304,47 @@ namespace {
             {
                 case UCM_PROCESSDATA:
                 {
-                    if (fwrite(reinterpret_cast<void *>(p1), 1, p2, self->m_tmpFile) != (size_t)p2)
-                        return -1;
+                    const unsigned char *data = reinterpret_cast<const unsigned char *>(p1);
+                    size_t size = p2;
+                    size_t tail;
+                    size_t chunk;
+                    int res = ERAR_SUCCESS;
 
-                    break;
+                    ::pthread_mutex_lock(&self->m_mutex);
+
+                    while (size > 0)
+                    {
+                        while (self->m_used == RingSize && self->m_state == Streaming)
+                            ::pthread_cond_wait(&self->m_condition, &self->m_mutex);
+
+                        /* Nobody reads the rest, drop it. */
+                        if (self->m_state != Streaming)
+                        {
+                            if (self->m_state == Aborting)
+                                res = -1;
+
+                            break;
+                        }
+
+                        tail = (self->m_head + self->m_used) % RingSize;
+                        chunk = RingSize - self->m_used;
+
+                        if (chunk > RingSize - tail)
+                            chunk = RingSize - tail;
+
+                        if (chunk > size)
+                            chunk = size;
+
+                        ::memcpy(self->m_ring + tail, data, chunk);
+                        self->m_used += chunk;
+                        data += chunk;
+                        size -= chunk;
+
+                        ::pthread_cond_broadcast(&self->m_condition);
+                    }
+
+                    ::pthread_mutex_unlock(&self->m_mutex);
+                    return res;
                 }
 
                 default:
@@ -187,7 +361,16 @@ namespace {
         mutable struct RAROpenArchiveDataEx m_archiveData;
         mutable struct RARHeaderDataEx m_archiveInfo;
 
-        FILE *m_tmpFile;
+        pthread_t m_thread;
+        pthread_mutex_t m_mutex;
+        pthread_cond_t m_condition;
+        bool m_started;
+        bool m_done;
+        State m_state;
+        int m_result;
+        unsigned char *m_ring;
+        size_t m_head;
+        size_t m_used;
     };
 }
 
@@ -199,11 +382,9 @@ Archive::Archive(const Interface::Holder &file) :
 Archive::~Archive()
 {}
 
-Archive::const_iterator Archive::begin() const
+Archive::ReaderHolder Archive::createReader() const
 {
-    ArchiveReader::Holder reader(new (std::nothrow) ArchiveReader(original(), password()));
-    const_cast<Archive *>(this)->process(reader);
-    return std_iterator<Entries>(entries().begin());
+    return ReaderHolder(new (std::nothrow) ArchiveReader(original(), password()));
 }
 
 }}}
@@ -33,8 +33,8 @@ public:
     Archive(const Interface::Holder &file);
     virtual ~Archive();
 
-public: /* IDirectory */
-    virtual const_iterator begin() const;
+protected:
+    virtual ReaderHolder createReader() const;
 };
 
 }}}
@@ -21,61 +21,344 @@
 #include <lvfs/IProperties>
 #include <brolly/assert.h>
 
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <archive.h>
 #include <archive_entry.h>
 
 #include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "lvfs_arc_Archive.h"
+#include "lvfs_arc_ContentCache.h"
+#include "lvfs_arc_Extractor.h"
+#include "lvfs_arc_ScanPool.h"
 
 
 namespace LVFS {
 namespace Arc {
 namespace {
+    typedef EFC::Map<EFC::String, Interface::Holder> Types;
+
+    /* Types of files by extension, shared by all archives. */
+    enum { MaxTypes = 256 };
+    pthread_mutex_t typesMutex = PTHREAD_MUTEX_INITIALIZER;
+    Types types;
+
+    /* A file known by the name only, there is no content to look at. */
+    class NamedFile : public Implements<IEntry>
+    {
+    public:
+        NamedFile(const char *name) :
+            m_name(name)
+        {}
+
+    public: /* IEntry */
+        virtual const char *title() const { return m_name; }
+        virtual const char *schema() const { return "file"; }
+        virtual const char *location() const { return m_name; }
+        virtual const IType *type() const { return NULL; }
+        virtual Interface::Holder open(IStream::Mode mode) const { return Interface::Holder(); }
+
+    private:
+        const char *m_name;
+    };
+
+    Interface::Holder typeOfName(const char *name)
+    {
+        /* Whole suffix, "a.tar.gz" and "b.gz" are not of one type. */
+        const char *ext = name[0] != 0 ? ::strchr(name + 1, '.') : NULL;
+        NamedFile file(name);
+        Interface::Holder type;
+
+        if (ext == NULL || ext[1] == 0)
+            return Module::desktop().typeOfFile(&file);
+
+        ::pthread_mutex_lock(&typesMutex);
+        Types::const_iterator i = types.find(ext + 1);
+
+        if (i != types.end())
+            type = i->second;
+        ::pthread_mutex_unlock(&typesMutex);
+
+        if (!type.isValid())
+        {
+            type = Module::desktop().typeOfFile(&file);
+
+            ::pthread_mutex_lock(&typesMutex);
+            if (types.size() < MaxTypes)
+                types.insert(Types::value_type(ext + 1, type));
+            ::pthread_mutex_unlock(&typesMutex);
+        }
+
+        return type;
+    }
+
+    pthread_mutex_t treeMutex = PTHREAD_MUTEX_INITIALIZER;
+
+    /* Scans of all archives, a queued task is left behind by an archive destroyed before it started. */
+    pthread_mutex_t scanMutex = PTHREAD_MUTEX_INITIALIZER;
+
+    class Locked
+    {
+    public:
+        Locked(pthread_mutex_t &mutex) :
+            m_mutex(mutex)
+        {
+            ::pthread_mutex_lock(&m_mutex);
+        }
+
+        ~Locked()
+        {
+            ::pthread_mutex_unlock(&m_mutex);
+        }
+
+    private:
+        pthread_mutex_t &m_mutex;
+    };
+
+
+    class CachedEntryFile : public Implements<IStream>
+    {
+    public:
+        CachedEntryFile(ContentCache::Content *content) :
+            m_content(content),
+            m_position(0)
+        {
+            ASSERT(m_content != NULL);
+        }
+
+        virtual ~CachedEntryFile()
+        {
+            ContentCache::instance().release(m_content);
+        }
+
+    public: /* IStream */
+        virtual size_t read(void *buffer, size_t size)
+        {
+            size_t res = m_content->size() - m_position < size ? m_content->size() - m_position : size;
+            ::memcpy(buffer, m_content->data() + m_position, res);
+            m_position += res;
+            return res;
+        }
+
+        virtual size_t write(const void *buffer, size_t size) { m_error = Error(EROFS); return 0; }
+        virtual bool advise(off_t offset, off_t len, Advise advise) { m_error = Error(EROFS); return false; }
+
+        virtual bool seek(long offset, Whence whence)
+        {
+            int64_t target;
+
+            switch (whence)
+            {
+                case SEEK_SET:
+                    target = offset;
+                    break;
+
+                case SEEK_CUR:
+                    target = m_position + offset;
+                    break;
+
+                default:
+                    target = m_content->size() + offset;
+                    break;
+            }
+
+            if (target < 0 || target > static_cast<int64_t>(m_content->size()))
+            {
+                m_error = Error(EINVAL);
+                return false;
+            }
+
+            m_position = target;
+            return true;
+        }
+
+        virtual bool flush() { m_error = Error(EROFS); return false; }
+
+        virtual const Error &lastError() const { return m_error; }
+
+    private:
+        mutable Error m_error;
+        ContentCache::Content *m_content;
+        size_t m_position;
+    };
 
 
     class ArchiveEntryFile : public Implements<IStream>
     {
     public:
-        ArchiveEntryFile(const Archive::Reader::Holder &reader) :
-            m_reader(reader)
+        enum { BufferSize = 65536 };
+
+    public:
+        ArchiveEntryFile(const Archive::Pool::Holder &pool, const Archive::Reader::Holder &reader, uint32_t slot,
+                         const char *path, uint32_t index, int64_t offset, int64_t size) :
+            m_pool(pool),
+            m_reader(reader),
+            m_slot(slot),
+            m_path(::strdup(path)),
+            m_index(index),
+            m_offset(offset),
+            m_size(size),
+            m_position(0),
+            m_content(NULL),
+            m_cacheable(m_pool->identity() != NULL && m_path != NULL && !m_reader->direct())
         {
             ASSERT(m_reader.isValid());
         }
 
+        virtual ~ArchiveEntryFile()
+        {
+            drop();
+            m_reader.reset();
+            m_pool->release(m_slot);
+            ::free(m_path);
+        }
+
     public: /* IStream */
-        virtual size_t read(void *buffer, size_t size) { return m_reader->read(buffer, size); }
+        virtual size_t read(void *buffer, size_t size)
+        {
+            size_t res = m_reader->read(buffer, size);
+
+            if (res == 0 && size > 0 && m_reader->error() != 0)
+            {
+                m_error = Error(m_reader->error());
+                drop();
+                return 0;
+            }
+
+            /*
+             * Entry read from the start to the end in one go is kept in the cache,
+             * unless it is read from the archive file as is anyway. Room for it is
+             * taken once reading starts at the beginning.
+             */
+            if (m_content == NULL && m_cacheable && m_position == 0 && res > 0)
+                m_content = ContentCache::instance().create(m_size);
+
+            if (m_content != NULL)
+                if (m_position + static_cast<int64_t>(res) > m_size)
+                    drop();
+                else
+                {
+                    ::memcpy(m_content->data() + m_position, buffer, res);
+
+                    if (m_position + static_cast<int64_t>(res) == m_size)
+                    {
+                        ContentCache::instance().insert(m_pool->identity(), m_path, m_content);
+                        drop();
+                    }
+                }
+
+            m_position += res;
+            return res;
+        }
+
         virtual size_t write(const void *buffer, size_t size) { m_error = Error(EROFS); return 0; }
         virtual bool advise(off_t offset, off_t len, Advise advise) { m_error = Error(EROFS); return false; }
-        virtual bool seek(long offset, Whence whence) { m_error = Error(EROFS); return false; }
+
+        virtual bool seek(long offset, Whence whence)
+        {
+            char buffer[BufferSize];
+            int64_t target;
+            size_t res;
+
+            switch (whence)
+            {
+                case SEEK_SET:
+                    target = offset;
+                    break;
+
+                case SEEK_CUR:
+                    target = m_position + offset;
+                    break;
+
+                default:
+                    target = m_size + offset;
+                    break;
+            }
+
+            if (target < 0 || target > m_size)
+            {
+                m_error = Error(EINVAL);
+                return false;
+            }
+
+            if (target != m_position)
+                drop();
+
+            if (m_reader->seek(target))
+            {
+                m_position = target;
+                return true;
+            }
+
+            if (target < m_position)
+                if (m_path != NULL && m_reader->locate(m_path, m_index, m_offset))
+                    m_position = 0;
+                else
+                {
+                    m_error = Error(EIO);
+                    return false;
+                }
+
+            for (; m_position < target; m_position += res)
+                if ((res = m_reader->read(buffer, target - m_position < BufferSize ? target - m_position : BufferSize)) == 0)
+                {
+                    m_error = Error(EIO);
+                    return false;
+                }
+
+            return true;
+        }
+
         virtual bool flush() { m_error = Error(EROFS); return false; }
 
         virtual const Error &lastError() const { return m_error; }
 
+    private:
+        void drop()
+        {
+            if (m_content != NULL)
+            {
+                ContentCache::instance().release(m_content);
+                m_content = NULL;
+            }
+        }
+
     private:
         mutable Error m_error;
+        Archive::Pool::Holder m_pool;
         Archive::Reader::Holder m_reader;
+        uint32_t m_slot;
+        char *m_path;
+        uint32_t m_index;
+        int64_t m_offset;
+        int64_t m_size;
+        int64_t m_position;
+        ContentCache::Content *m_content;
+        bool m_cacheable;
     };
 
 
     class ArchiveEntry : public Implements<IEntry, IProperties>
     {
     public:
-        ArchiveEntry(const Archive::Reader::Holder &reader) :
-            m_reader(reader),
-            m_path(::strdup(m_reader->archive_entry_pathname())),
-            m_title(::strrchr(m_path, '/')),
-            m_cTime(m_reader->archive_entry_ctime()),
-            m_mTime(m_reader->archive_entry_mtime()),
-            m_aTime(m_reader->archive_entry_atime()),
-            m_perm(m_reader->archive_entry_perm()),
-            m_size(m_reader->archive_entry_size())
+        ArchiveEntry(const Archive::Pool::Holder &pool, const Listing::Holder &listing, uint32_t record, bool listed = false) :
+            m_pool(pool),
+            m_path(listing->path(record)),
+            m_title(listing->name(record)),
+            m_cTime(listing->record(record).cTime),
+            m_mTime(listing->record(record).mTime),
+            m_aTime(listing->record(record).aTime),
+            m_perm(listing->record(record).perm),
+            m_size(listing->record(record).size),
+            m_offset(listing->record(record).offset),
+            m_index(listing->record(record).index),
+            m_listed(listed)
         {
-            if (m_title != NULL)
-                ++m_title;
-            else
-                m_title = m_path;
+            if (m_path != NULL)
+                m_title = m_path + ::strlen(m_path) - ::strlen(m_title);
         }
 
         virtual ~ArchiveEntry()
@@ -83,31 +366,71 @@ namespace {
             ::free(m_path);
         }
 
-        void initType()
-        {
-            m_type = Module::desktop().typeOfFile(this);
-            ASSERT(m_type.isValid());
-        }
+        inline bool isValid() const { return m_path != NULL; }
+        inline int64_t offset() const { return m_offset; }
+        inline uint32_t index() const { return m_index; }
 
     public: /* IEntry */
         virtual const char *title() const { return m_title; }
         virtual const char *schema() const { return "file"; }
         virtual const char *location() const { return m_path; }
-        virtual const IType *type() const { return m_type; }
+        virtual const IType *type() const
+        {
+            ::pthread_mutex_lock(&typesMutex);
+            bool known = m_type.isValid();
+            ::pthread_mutex_unlock(&typesMutex);
+
+            if (!known)
+            {
+                /*
+                 * Entries given to listeners are typed by the extension alone,
+                 * any other entry is looked at by the desktop (without the lock,
+                 * that may read the content).
+                 */
+                Interface::Holder type(m_listed ? typeOfName(m_title) : Module::desktop().typeOfFile(this));
+                ASSERT(type.isValid());
+
+                ::pthread_mutex_lock(&typesMutex);
+                if (!m_type.isValid())
+                    m_type = type;
+                ::pthread_mutex_unlock(&typesMutex);
+            }
+
+            return m_type;
+        }
         virtual Interface::Holder open(IStream::Mode mode) const
         {
             if (mode == IStream::Read)
-                if (m_reader->isOpen() && ::strcmp(m_path, m_reader->archive_entry_pathname()) == 0)
-                    return Interface::Holder(new (std::nothrow) ArchiveEntryFile(m_reader));
-                else
+            {
+                uint32_t slot;
+
+                if (m_pool->identity() != NULL)
+                    if (ContentCache::Content *content = ContentCache::instance().find(m_pool->identity(), m_path))
+                    {
+                        Interface::Holder res(new (std::nothrow) CachedEntryFile(content));
+
+                        if (LIKELY(res.isValid() == true))
+                            return res;
+
+                        ContentCache::instance().release(content);
+                    }
+
+                Archive::Reader::Holder reader(m_pool->acquire(m_index, slot));
+
+                if (reader.isValid())
                 {
-                    m_reader->close();
+                    if (reader->locate(m_path, m_index, m_offset))
+                    {
+                        Interface::Holder res(new (std::nothrow) ArchiveEntryFile(m_pool, reader, slot, m_path, m_index, m_offset, m_size));
+
+                        if (LIKELY(res.isValid() == true))
+                            return res;
+                    }
 
-                    if (m_reader->open())
-                        while (m_reader->next())
-                            if (::strcmp(m_path, m_reader->archive_entry_pathname()) == 0)
-                                return Interface::Holder(new (std::nothrow) ArchiveEntryFile(m_reader));
+                    reader.reset();
+                    m_pool->release(slot);
                 }
+            }
 
             return Interface::Holder();
         }
@@ -120,7 +443,7 @@ namespace {
         virtual int permissions() const { return m_perm; }
 
     private:
-        mutable Archive::Reader::Holder m_reader;
+        Archive::Pool::Holder m_pool;
 
         char *m_path;
         const char *m_title;
@@ -129,27 +452,65 @@ namespace {
         time_t m_aTime;
         int m_perm;
         uint64_t m_size;
+        int64_t m_offset;
+        uint32_t m_index;
+        bool m_listed;
 
-        Interface::Adaptor<IType> m_type;
+        mutable Interface::Adaptor<IType> m_type;
     };
 
 
+    class Dir;
+
+    Interface::Holder node(const Archive::Pool::Holder &pool, const Listing::Holder &listing, uint32_t record,
+                           const Interface::Holder &file);
+
+    /* Entries of a directory are made from the listing on the first iteration. */
+    void materialize(const Archive::Pool::Holder &pool, const Listing::Holder &listing, uint32_t dir,
+                     const Interface::Holder &file, Archive::Entries &entries, bool &done);
+
+    /*
+     * Paths going on past a file of the archive continue in its content
+     * (nested archive). The file is handed to content plugins on the first
+     * such lookup, what they return is kept in contents.
+     */
+    Interface::Holder lookup(const Archive::Pool::Holder &pool, const Listing::Holder &listing, uint32_t base,
+                             const Interface::Holder &file, Archive::Entries &contents, const char *name, int &error);
+
+
+    /* Archives are read-only, copying to a local directory unpacks into it. */
+    const char *destination(const Interface::Holder &file)
+    {
+        struct stat st;
+
+        /* Directories inside archives say "file" too, their location is the archive. */
+        if (file.isValid() && file->as<IDirectory>() != NULL && ::strcmp(file->as<IEntry>()->schema(), "file") == 0 &&
+            ::stat(file->as<IEntry>()->location(), &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            return file->as<IEntry>()->location();
+        }
+
+        return NULL;
+    }
+
+
     class Dir : public Implements<IEntry, IDirectory>
     {
     public:
-        Dir(const EFC::String &title, const Interface::Holder &file) :
-            m_title(title),
+        Dir(const Archive::Pool::Holder &pool, const Listing::Holder &listing, uint32_t record, const Interface::Holder &file) :
+            m_pool(pool),
+            m_listing(listing),
+            m_record(record),
             m_file(file),
-            m_type(Module::desktop().typeOfDirectory())
+            m_type(Module::desktop().typeOfDirectory()),
+            m_materialized(false)
         {}
 
         virtual ~Dir()
         {}
 
-        Archive::Entries *entries() { return &m_entries; }
-
     public: /* IEntry */
-        virtual const char *title() const { return m_title.c_str(); }
+        virtual const char *title() const { return m_listing->name(m_record); }
         virtual const char *schema() const { return "file"; }
         virtual const char *location() const { return m_file->as<IEntry>()->location(); }
         virtual const IType *type() const { return m_type; }
@@ -160,180 +521,1203 @@ namespace {
         }
 
     public: /* IDirectory */
-        virtual const_iterator begin() const { return std_iterator<Archive::Entries>(m_entries.begin()); }
+        virtual const_iterator begin() const
+        {
+            materialize(m_pool, m_listing, m_record, m_file, m_entries, m_materialized);
+            return std_iterator<Archive::Entries>(m_entries.begin());
+        }
+
         virtual const_iterator end() const { return std_iterator<Archive::Entries>(m_entries.end()); }
 
-        virtual bool exists(const char *name) const { return false; }
-        virtual Interface::Holder entry(const char *name, const IType *type = NULL, bool create = false) { return Interface::Holder(); }
+        virtual bool exists(const char *name) const
+        {
+            int error;
+            return lookup(m_pool, m_listing, m_record, m_file, m_contents, name, error).isValid();
+        }
+
+        virtual Interface::Holder entry(const char *name, const IType *type = NULL, bool create = false)
+        {
+            int error;
+            Interface::Holder res(lookup(m_pool, m_listing, m_record, m_file, m_contents, name, error));
+
+            if (!res.isValid())
+                m_error = Error(create && error == ENOENT ? EROFS : error);
+
+            return res;
+        }
+
+        virtual bool copy(const Progress &callback, const Interface::Holder &file, bool move = false)
+        {
+            const char *path = destination(file);
+
+            if (move || path == NULL)
+            {
+                m_error = Error(EROFS);
+                return false;
+            }
+
+            Extractor extractor(m_pool, m_listing, m_record, m_listing->record(m_record).parent, path, callback);
+
+            if (extractor.run())
+                return true;
+
+            m_error = Error(extractor.error());
+            return false;
+        }
 
-        virtual bool copy(const Progress &callback, const Interface::Holder &file, bool move = false) { return false; }
         virtual bool rename(const Interface::Holder &file, const char *name) { return false; }
         virtual bool remove(const Interface::Holder &file) { return false; }
 
         virtual const Error &lastError() const { return m_error; }
 
     private:
-        EFC::String m_title;
+        Archive::Pool::Holder m_pool;
+        Listing::Holder m_listing;
+        uint32_t m_record;
         Interface::Holder m_file;
-        Archive::Entries m_entries;
+        mutable Archive::Entries m_entries;
+        mutable Archive::Entries m_contents;
         Interface::Adaptor<IType> m_type;
+        mutable bool m_materialized;
         mutable Error m_error;
     };
 
 
-}
+    Interface::Holder node(const Archive::Pool::Holder &pool, const Listing::Holder &listing, uint32_t record,
+                           const Interface::Holder &file)
+    {
+        Interface::Holder res;
 
+        if (listing->isDir(record))
+            res.reset(new (std::nothrow) Dir(pool, listing, record, file));
+        else
+        {
+            res.reset(new (std::nothrow) ArchiveEntry(pool, listing, record));
 
-Archive::Archive(const Interface::Holder &file) :
-    ExtendsBy(file),
-    m_password(NULL),
-    m_lastError(&m_error)
-{
-    ASSERT(file.isValid());
-}
+            if (LIKELY(res.isValid() == true) && UNLIKELY(res.as<ArchiveEntry>()->isValid() == false))
+                res.reset();
+        }
 
-Archive::~Archive()
-{
-    if (m_password)
-        free(m_password);
-}
+        return res;
+    }
 
-Archive::const_iterator Archive::end() const
-{
-    return std_iterator<Entries>(m_entries.end());
-}
+    void materialize(const Archive::Pool::Holder &pool, const Listing::Holder &listing, uint32_t dir,
+                     const Interface::Holder &file, Archive::Entries &entries, bool &done)
+    {
+        Interface::Holder entry;
 
-bool Archive::exists(const char *name) const
-{
-    return false;
-}
+        ::pthread_mutex_lock(&treeMutex);
 
-Interface::Holder Archive::entry(const char *name, const IType *type, bool create)
-{
-    return Interface::Holder();
-}
+        if (!done)
+        {
+            for (uint32_t i = listing->first(dir); i != Listing::None; i = listing->record(i).sibling)
+                if (LIKELY((entry = node(pool, listing, i, file)).isValid() == true))
+                    entries.insert(Archive::Entries::value_type(listing->name(i), entry));
 
-bool Archive::copy(const Progress &callback, const Interface::Holder &file, bool move)
-{
-    return false;
-}
+            done = true;
+        }
 
-bool Archive::rename(const Interface::Holder &file, const char *name)
-{
-    m_lastError = &m_error;
-    m_error = Error(0);
-    return false;
-}
+        ::pthread_mutex_unlock(&treeMutex);
+    }
 
-bool Archive::remove(const Interface::Holder &file)
-{
-    m_lastError = &m_error;
-    m_error = Error(0);
-    return false;
-}
+    Interface::Holder lookup(const Archive::Pool::Holder &pool, const Listing::Holder &listing, uint32_t base,
+                             const Interface::Holder &file, Archive::Entries &contents, const char *name, int &error)
+    {
+        Archive::Entries::const_iterator i;
+        Interface::Holder content;
+        Interface::Holder entry;
+        IDirectory *dir;
+        uint32_t record;
+        char *prefix;
+        bool probed;
 
-const char *Archive::password() const
-{
-    return m_password;
-}
+        if ((record = listing->find(name, base)) != Listing::None)
+        {
+            if (LIKELY((entry = node(pool, listing, record, file)).isValid() == true))
+                return entry;
 
-void Archive::setPassword(const char *value)
-{
-    if (m_password)
-        free(m_password);
+            error = ENOMEM;
+            return entry;
+        }
 
-    m_password = strdup(value);
-}
+        for (const char *p = ::strchr(name, '/'); p != NULL; p = ::strchr(p + 1, '/'))
+        {
+            if (UNLIKELY((prefix = ::strndup(name, p - name)) == NULL))
+            {
+                error = ENOMEM;
+                return Interface::Holder();
+            }
 
-const Error &Archive::lastError() const
-{
-    return *m_lastError;
-}
+            if ((record = listing->find(prefix, base)) == Listing::None || listing->isDir(record))
+            {
+                ::free(prefix);
 
-bool Archive::process(ReaderHolder &reader)
+                if (record == Listing::None)
+                    break;
+
+                continue;
+            }
+
+            ::pthread_mutex_lock(&treeMutex);
+            if (probed = (i = contents.find(prefix)) != contents.end())
+                content = i->second;
+            ::pthread_mutex_unlock(&treeMutex);
+
+            /* Plugins read the file, that is not done under the lock. */
+            if (!probed && (entry = node(pool, listing, record, file)).isValid())
+            {
+                content = Module::open(entry);
+
+                ::pthread_mutex_lock(&treeMutex);
+                contents.insert(Archive::Entries::value_type(prefix, content));
+                ::pthread_mutex_unlock(&treeMutex);
+            }
+
+            ::free(prefix);
+
+            while (*p == '/')
+                ++p;
+
+            if (content.isValid() && (dir = content->as<IDirectory>()) != NULL)
+            {
+                if (*p == 0)
+                    return content;
+
+                if (!(entry = dir->entry(p)).isValid())
+                    error = dir->lastError().code();
+
+                return entry;
+            }
+
+            error = ENOTDIR;
+            return Interface::Holder();
+        }
+
+        error = ENOENT;
+        return Interface::Holder();
+    }
+}
+
+
+class Archive::ScanTask : public ScanPool::Task
 {
-    if (reader.isValid() && reader->open())
+public:
+    ScanTask(Archive *archive, Completion &completion, Listener *listener) :
+        m_archive(archive),
+        m_completion(completion),
+        m_listener(listener)
+    {}
+
+    /* Archive was destroyed before the task started or by the completion callback. */
+    inline void orphan() { m_archive = NULL; }
+
+    virtual void run()
     {
-        Interface::Holder entry;
-        Interface::Holder dir;
-        EFC::String key;
-        Entries *entries;
-        char *path;
-        char *sep;
-
-        do
-            if (reader->next())
+        Listener *listener = m_listener ? m_listener : &m_all;
+        bool res;
+
+        ::pthread_mutex_lock(&scanMutex);
+
+        if (m_archive == NULL)
+        {
+            ::pthread_mutex_unlock(&scanMutex);
+            return;
+        }
+
+        m_archive->m_scanThread = ::pthread_self();
+        m_archive->m_scanStarted = true;
+        ::pthread_mutex_unlock(&scanMutex);
+
+        res = m_archive->list(*listener);
+        m_completion.completed(m_archive, res);
+
+        ::pthread_mutex_lock(&scanMutex);
+
+        if (m_archive)
+        {
+            m_archive->m_scan = NULL;
+            m_archive->m_scanStarted = false;
+            ::pthread_cond_broadcast(&m_archive->m_scanCond);
+        }
+
+        ::pthread_mutex_unlock(&scanMutex);
+    }
+
+private:
+    class All : public Listener
+    {
+    public:
+        virtual bool found(const Interface::Holder &entry) { return true; }
+    };
+
+private:
+    Archive *m_archive;
+    Completion &m_completion;
+    Listener *m_listener;
+    All m_all;
+};
+
+
+/* Entries shared by threads of extractParallel(), each with a reader of its own. */
+class Archive::Extraction
+{
+public:
+    enum { BufferSize = 1024 * 1024 };
+
+public:
+    Extraction(const PoolHolder &pool, Sink &sink, const Interface::Holder *entries, size_t count) :
+        m_pool(pool),
+        m_sink(sink),
+        m_entries(entries),
+        m_count(count),
+        m_next(0),
+        m_error(0)
+    {
+        ::pthread_mutex_init(&m_mutex, NULL);
+    }
+
+    ~Extraction()
+    {
+        ::pthread_mutex_destroy(&m_mutex);
+    }
+
+    inline int error() const { return m_error; }
+
+    static void *worker(void *extraction)
+    {
+        Extraction *self = static_cast<Extraction *>(extraction);
+        uint32_t slot;
+        ReaderHolder reader(self->m_pool->acquire(0, slot, Pool::Spare));
+
+        /* Readers are held by open entries, the other threads do the work. */
+        if (reader.isValid())
+        {
+            self->run(reader);
+            reader.reset();
+            self->m_pool->release(slot);
+        }
+
+        return NULL;
+    }
+
+    void run(const ReaderHolder &reader)
+    {
+        const Interface::Holder *entry;
+        const ArchiveEntry *archiveEntry;
+        char *buffer;
+        const void *data;
+        size_t size;
+        int64_t offset;
+        bool res = true;
+
+        if (UNLIKELY((buffer = static_cast<char *>(::malloc(BufferSize))) == NULL))
+        {
+            fail(ENOMEM);
+            return;
+        }
+
+        while (res && (entry = take()) != NULL)
+        {
+            archiveEntry = entry->as<ArchiveEntry>();
+
+            if (!reader->locate(archiveEntry->location(), archiveEntry->index(), archiveEntry->offset()))
             {
-                entries = &m_entries;
-                entry.reset(new (std::nothrow) ArchiveEntry(reader));
+                fail(EIO);
+                break;
+            }
 
-                if (LIKELY(entry.isValid() == true))
-                {
-                    path = const_cast<char *>(entry.as<ArchiveEntry>()->location());
+            for (offset = 0; (size = reader->readBlock(buffer, BufferSize, data, offset)) > 0; offset += size)
+                if (!(res = m_sink.write(*entry, data, size, offset)))
+                    break;
 
-                    while (sep = ::strchr(path, '/'))
-                    {
-                        *sep = 0;
-                        Entries::iterator lb = entries->lower_bound(key = path);
-                        *sep = '/';
-                        path = sep + 1;
-
-                        if (lb != entries->end() && !(entries->key_comp()(key, lb->first)))
-                            entries = lb->second.as<Dir>()->entries();
-                        else
-                        {
-                            dir.reset(new (std::nothrow) Dir(key, original()));
-
-                            if (UNLIKELY(dir.isValid() == false))
-                            {
-                                reader->close();
-                                reader.reset();
-                                m_entries.clear();
-                                return false;
-                            }
-
-                            entries->insert(lb, Entries::value_type(key, dir));
-                            entries = dir.as<Dir>()->entries();
-                        }
-                    }
+            /* Data cut short is not handed over as a complete entry. */
+            if (res && reader->error() != 0)
+            {
+                fail(reader->error());
+                break;
+            }
 
-                    entry.as<ArchiveEntry>()->initType();
+            if (!res || !(res = m_sink.done(*entry)))
+                fail(ECANCELED);
+        }
 
-                    if ((dir = Module::open(entry)).isValid())
-                        entry = dir;
+        reader->close();
+        ::free(buffer);
+    }
 
-                    entries->insert(Entries::value_type(path, entry));
-                }
-                else
+private:
+    const Interface::Holder *take()
+    {
+        const Interface::Holder *res = NULL;
+
+        ::pthread_mutex_lock(&m_mutex);
+
+        if (m_error == 0 && m_next < m_count)
+            res = &m_entries[m_next++];
+
+        ::pthread_mutex_unlock(&m_mutex);
+        return res;
+    }
+
+    void fail(int error)
+    {
+        ::pthread_mutex_lock(&m_mutex);
+
+        if (m_error == 0)
+            m_error = error;
+
+        ::pthread_mutex_unlock(&m_mutex);
+    }
+
+private:
+    PoolHolder m_pool;
+    Sink &m_sink;
+    const Interface::Holder *m_entries;
+    size_t m_count;
+    size_t m_next;
+    int m_error;
+    pthread_mutex_t m_mutex;
+};
+
+
+Archive::Archive(const Interface::Holder &file) :
+    ExtendsBy(file),
+    m_password(NULL),
+    m_loaded(false),
+    m_materialized(false),
+    m_size(0),
+    m_cancel(false),
+    m_scan(NULL),
+    m_scanStarted(false),
+    m_lastError(&m_error)
+{
+    pthread_mutexattr_t attr;
+
+    ASSERT(file.isValid());
+    m_mTime.tv_sec = 0;
+    m_mTime.tv_nsec = 0;
+
+    /* Public calls nest (extractParallel() falls back to extract()). */
+    ::pthread_mutexattr_init(&attr);
+    ::pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    ::pthread_mutex_init(&m_mutex, &attr);
+    ::pthread_mutexattr_destroy(&attr);
+
+    ::pthread_cond_init(&m_scanCond, NULL);
+}
+
+Archive::~Archive()
+{
+    ::pthread_mutex_lock(&scanMutex);
+
+    /* Task taken by a worker but not started yet finds itself orphaned. */
+    if (m_scan != NULL)
+        if (ScanPool::instance().cancel(m_scan))
+            delete m_scan;
+        else if (!m_scanStarted || ::pthread_equal(m_scanThread, ::pthread_self()))
+            m_scan->orphan();
+        else
+        {
+            setCancelled(true);
+
+            while (m_scan != NULL)
+                ::pthread_cond_wait(&m_scanCond, &scanMutex);
+        }
+
+    ::pthread_mutex_unlock(&scanMutex);
+    ::pthread_cond_destroy(&m_scanCond);
+    ::pthread_mutex_destroy(&m_mutex);
+
+    if (m_password)
+        free(m_password);
+}
+
+Archive::const_iterator Archive::begin() const
+{
+    Archive *self = const_cast<Archive *>(this);
+    Locked lock(m_mutex);
+
+    if (self->update())
+        materialize(m_pool, m_listing, Listing::Root, original(), self->m_entries, self->m_materialized);
+
+    return std_iterator<Entries>(m_entries.begin());
+}
+
+Archive::const_iterator Archive::end() const
+{
+    Locked lock(m_mutex);
+    return std_iterator<Entries>(m_entries.end());
+}
+
+bool Archive::exists(const char *name) const
+{
+    Archive *self = const_cast<Archive *>(this);
+    Locked lock(m_mutex);
+    int error;
+
+    return self->update() && lookup(m_pool, m_listing, Listing::Root, original(), self->m_contents, name, error).isValid();
+}
+
+Interface::Holder Archive::entry(const char *name, const IType *type, bool create)
+{
+    Locked lock(m_mutex);
+    Interface::Holder res;
+    int error;
+
+    m_lastError = &m_error;
+
+    if (!update())
+    {
+        m_error = Error(EIO);
+        return Interface::Holder();
+    }
+
+    if (!(res = lookup(m_pool, m_listing, Listing::Root, original(), m_contents, name, error)).isValid())
+        m_error = Error(create && error == ENOENT ? EROFS : error);
+
+    return res;
+}
+
+bool Archive::copy(const Progress &callback, const Interface::Holder &file, bool move)
+{
+    const char *path = destination(file);
+    Locked lock(m_mutex);
+
+    m_lastError = &m_error;
+
+    if (move || path == NULL)
+    {
+        m_error = Error(EROFS);
+        return false;
+    }
+
+    if (!update())
+    {
+        m_error = Error(EIO);
+        return false;
+    }
+
+    Extractor extractor(m_pool, m_listing, Listing::Root, Listing::Root, path, callback);
+
+    if (extractor.run())
+        return true;
+
+    m_error = Error(extractor.error());
+    return false;
+}
+
+bool Archive::rename(const Interface::Holder &file, const char *name)
+{
+    m_lastError = &m_error;
+    m_error = Error(0);
+    return false;
+}
+
+bool Archive::remove(const Interface::Holder &file)
+{
+    m_lastError = &m_error;
+    m_error = Error(0);
+    return false;
+}
+
+const char *Archive::password() const
+{
+    Locked lock(m_mutex);
+    return m_password;
+}
+
+void Archive::setPassword(const char *value)
+{
+    Locked lock(m_mutex);
+
+    if (m_password)
+        free(m_password);
+
+    m_password = strdup(value);
+
+    /* Listing (empty if headers are encrypted) and readers were made with the old one. */
+    m_loaded = false;
+    m_pool.reset();
+}
+
+bool Archive::refresh()
+{
+    Locked lock(m_mutex);
+    m_loaded = false;
+    return update();
+}
+
+bool Archive::extract(Sink &sink)
+{
+    Locked lock(m_mutex);
+    return unpack(NULL, sink);
+}
+
+bool Archive::extract(const Interface::Holder *entries, size_t count, Sink &sink)
+{
+    Locked lock(m_mutex);
+    Entries wanted;
+
+    for (size_t i = 0; i < count; ++i)
+        wanted.insert(Entries::value_type(entries[i]->as<IEntry>()->location(), entries[i]));
+
+    return unpack(&wanted, sink);
+}
+
+bool Archive::extractParallel(Sink &sink, const Interface::Holder *entries, size_t count)
+{
+    long cpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t threads[Pool::MaxReaders];
+    uint32_t started = 0;
+    Interface::Holder *all = NULL;
+    ReaderHolder reader;
+    uint32_t slot;
+    bool res;
+    Locked lock(m_mutex);
+
+    m_lastError = &m_error;
+
+    if (!update())
+    {
+        m_error = Error(EIO);
+        return false;
+    }
+
+    if (UNLIKELY((reader = m_pool->acquire(0, slot, Pool::Reserved)).isValid() == false))
+    {
+        m_error = Error(ENOMEM);
+        return false;
+    }
+
+    if (!reader->independent() || cpus < 2)
+    {
+        reader.reset();
+        m_pool->release(slot);
+        return entries ? extract(entries, count, sink) : extract(sink);
+    }
+
+    for (size_t i = 0; i < count; ++i)
+        if (entries[i].as<ArchiveEntry>() == NULL)
+        {
+            reader.reset();
+            m_pool->release(slot);
+            m_error = Error(EINVAL);
+            return false;
+        }
+
+    if (entries == NULL)
+    {
+        if (UNLIKELY((all = new (std::nothrow) Interface::Holder[m_listing->count()]) == NULL))
+        {
+            reader.reset();
+            m_pool->release(slot);
+            m_error = Error(ENOMEM);
+            return false;
+        }
+
+        for (uint32_t i = Listing::Root + 1, total = m_listing->count(); i < total; ++i)
+            if (!m_listing->isDir(i))
+            {
+                all[count].reset(new (std::nothrow) ArchiveEntry(m_pool, m_listing, i, true));
+
+                if (UNLIKELY(all[count].isValid() == false) || UNLIKELY(all[count].as<ArchiveEntry>()->isValid() == false))
                 {
-                    reader->close();
                     reader.reset();
-                    m_entries.clear();
+                    m_pool->release(slot);
+                    delete [] all;
+                    m_error = Error(ENOMEM);
                     return false;
                 }
+
+                if (sink.accept(all[count]))
+                    ++count;
+                else
+                    all[count].reset();
+            }
+
+        entries = all;
+    }
+
+    {
+        Extraction extraction(m_pool, sink, entries, count);
+
+        /* This thread is one of the workers. */
+        for (long i = 1; i < cpus && i < Pool::MaxReaders && i < static_cast<long>(count); ++i)
+            if (::pthread_create(&threads[started], NULL, Extraction::worker, &extraction) == 0)
+                ++started;
+
+        extraction.run(reader);
+        reader.reset();
+        m_pool->release(slot);
+
+        for (uint32_t i = 0; i < started; ++i)
+            ::pthread_join(threads[i], NULL);
+
+        if (!(res = extraction.error() == 0))
+            m_error = Error(extraction.error());
+    }
+
+    delete [] all;
+    return res;
+}
+
+bool Archive::scan(Listener &listener)
+{
+    ::pthread_mutex_lock(&scanMutex);
+    setCancelled(false);
+    ::pthread_mutex_unlock(&scanMutex);
+
+    return list(listener);
+}
+
+bool Archive::scanAsync(Completion &completion, Listener *listener)
+{
+    bool res = false;
+
+    ::pthread_mutex_lock(&scanMutex);
+
+    if (m_scan == NULL && (m_scan = new (std::nothrow) ScanTask(this, completion, listener)) != NULL)
+    {
+        setCancelled(false);
+        m_scanStarted = false;
+
+        if (!(res = ScanPool::instance().submit(m_scan)))
+        {
+            delete m_scan;
+            m_scan = NULL;
+        }
+    }
+
+    ::pthread_mutex_unlock(&scanMutex);
+    return res;
+}
+
+void Archive::cancel()
+{
+    setCancelled(true);
+}
+
+const Error &Archive::lastError() const
+{
+    return *m_lastError;
+}
+
+bool Archive::update(Listener *listener)
+{
+    const IEntry *file = original()->as<IEntry>();
+    char identity[4096];
+    struct stat st;
+    bool local = ::strcmp(file->schema(), "file") == 0 && ::stat(file->location(), &st) == 0;
+    Listing::Holder listing;
+    ReaderHolder reader;
+    PoolHolder pool;
+    bool identified;
+    bool res;
+
+    /*
+     * Listing is built without the lock, listeners may call back into the
+     * archive. The lock is held to look at and to publish the state only.
+     */
+    ::pthread_mutex_lock(&m_mutex);
+
+    if (m_loaded && (!local || (st.st_size == m_size && st.st_mtim.tv_sec == m_mTime.tv_sec && st.st_mtim.tv_nsec == m_mTime.tv_nsec)))
+    {
+        pool = m_pool;
+        listing = m_listing;
+        ::pthread_mutex_unlock(&m_mutex);
+
+        if (listener)
+            report(pool, listing, *listener, Listing::None);
+
+        return true;
+    }
+
+    ::pthread_mutex_unlock(&m_mutex);
+
+    reader = createReader();
+    listing.reset(new (std::nothrow) Listing());
+
+    /* Contents of an archive which is not a local file can not be validated. */
+    identified = local && ::snprintf(identity, sizeof(identity), "%s:%lld:%ld.%09ld", file->location(),
+                                     static_cast<long long>(st.st_size), static_cast<long>(st.st_mtim.tv_sec),
+                                     static_cast<long>(st.st_mtim.tv_nsec)) < static_cast<int>(sizeof(identity));
+
+    if (LIKELY(reader.isValid() == true))
+        pool.reset(new (std::nothrow) Pool(reader, identified ? identity : NULL));
+
+    res = pool.isValid() && listing.isValid() && load(pool, listing, listener);
+
+    ::pthread_mutex_lock(&m_mutex);
+
+    if (local)
+    {
+        m_size = st.st_size;
+        m_mTime = st.st_mtim;
+    }
+
+    m_entries.clear();
+    m_contents.clear();
+    m_materialized = false;
+    m_listing = listing;
+    m_pool = pool;
+    m_loaded = res;
+
+    ::pthread_mutex_unlock(&m_mutex);
+    return res;
+}
+
+bool Archive::load(const PoolHolder &pool, const Listing::Holder &listing, Listener *listener)
+{
+    IndexCache cache(original()->as<IEntry>());
+
+    if (cache.load())
+    {
+        IndexCache::Entry info;
+
+        for (uint32_t i = 0, count = cache.count(); i < count; ++i)
+        {
+            cache.entry(i, info);
+
+            if (UNLIKELY(listing->add(info.path, i, info.size, info.offset, info.cTime, info.mTime, info.aTime, info.perm) == false))
+                return false;
+        }
+
+        /* Listing is complete, stopping the report does not discard it. */
+        if (listener)
+            report(pool, listing, *listener, Listing::None);
+
+        return true;
+    }
+
+    return process(pool, listing, cache.isValid() ? &cache : NULL, listener);
+}
+
+bool Archive::process(const PoolHolder &pool, const Listing::Holder &listing, IndexCache *cache, Listener *listener)
+{
+    uint32_t slot;
+    ReaderHolder reader(pool->acquire(0, slot, Pool::Reserved));
+    bool res = true;
+
+    if (UNLIKELY(reader.isValid() == false))
+        return false;
+
+    if (reader->isOpen())
+        reader->close();
+
+    if (reader->openListing() || reader->open())
+    {
+        IndexCache::Entry info;
+        uint32_t index = 0;
+        uint32_t record;
+
+        while (reader->next())
+        {
+            info.path = reader->archive_entry_pathname();
+            info.size = reader->archive_entry_size();
+            info.offset = reader->archive_entry_offset();
+            info.cTime = reader->archive_entry_ctime();
+            info.mTime = reader->archive_entry_mtime();
+            info.aTime = reader->archive_entry_atime();
+            info.perm = reader->archive_entry_perm();
+
+            if (UNLIKELY(listing->add(info.path, index, info.size, info.offset, info.cTime, info.mTime, info.aTime, info.perm, &record) == false) ||
+                (listener && record != Listing::None && !report(pool, listing, *listener, record)))
+            {
+                cache = NULL;
+                res = false;
+                break;
+            }
+
+            if (cache && !cache->add(info))
+                cache = NULL;
+
+            ++index;
+        }
+
+        /* Listing cut short by a damaged or half-written archive is not kept for good. */
+        if (cache && reader->error() == 0)
+            cache->save();
+
+        reader->close();
+    }
+    else
+    {
+        m_error = Error(reader->error() ? reader->error() : EIO);
+        res = false;
+    }
+
+    reader.reset();
+    pool->release(slot);
+    return res;
+}
+
+
+bool Archive::list(Listener &listener)
+{
+    bool res = update(&listener);
+    Locked lock(m_mutex);
+
+    m_lastError = &m_error;
+
+    if (res && !cancelled())
+        return true;
+
+    m_error = Error(cancelled() ? ECANCELED : EIO);
+    return false;
+}
+
+bool Archive::report(const PoolHolder &pool, const Listing::Holder &listing, Listener &listener, uint32_t record)
+{
+    Interface::Holder entry;
+
+    /* All files of the listing are reported if no record is given. */
+    if (record == Listing::None)
+    {
+        for (uint32_t i = Listing::Root + 1, count = listing->count(); i < count; ++i)
+            if (!listing->isDir(i) && !report(pool, listing, listener, i))
+                return false;
+
+        return true;
+    }
+
+    if (cancelled())
+        return false;
+
+    entry.reset(new (std::nothrow) ArchiveEntry(pool, listing, record, true));
+
+    if (UNLIKELY(entry.isValid() == false) || UNLIKELY(entry.as<ArchiveEntry>()->isValid() == false))
+        return false;
+
+    if (listener.found(entry))
+        return true;
+
+    setCancelled(true);
+    return false;
+}
+
+Interface::Holder Archive::find(const char *path) const
+{
+    uint32_t record = m_listing->find(path);
+    Interface::Holder res;
+
+    if (record != Listing::None && !m_listing->isDir(record))
+    {
+        res.reset(new (std::nothrow) ArchiveEntry(m_pool, m_listing, record));
+
+        if (LIKELY(res.isValid() == true) && UNLIKELY(res.as<ArchiveEntry>()->isValid() == false))
+            res.reset();
+    }
+
+    return res;
+}
+
+bool Archive::unpack(const Entries *wanted, Sink &sink)
+{
+    enum { BufferSize = 1024 * 1024 };
+    size_t left = wanted ? wanted->size() : 0;
+    Interface::Holder entry;
+    Entries::const_iterator i;
+    ReaderHolder reader;
+    uint32_t slot;
+    char *buffer;
+    const void *data;
+    int64_t offset;
+    size_t size;
+    bool res;
+
+    m_lastError = &m_error;
+
+    if (!update())
+    {
+        m_error = Error(EIO);
+        return false;
+    }
+
+    if (UNLIKELY((buffer = static_cast<char *>(::malloc(BufferSize))) == NULL))
+    {
+        m_error = Error(ENOMEM);
+        return false;
+    }
+
+    if (UNLIKELY((reader = m_pool->acquire(0, slot, Pool::Reserved)).isValid() == false))
+    {
+        ::free(buffer);
+        m_error = Error(ENOMEM);
+        return false;
+    }
+
+    /* One pass in the archive order, whatever order entries were given in. */
+    if (reader->isOpen())
+        reader->close();
+
+    if (!(res = reader->open()))
+        m_error = Error(EIO);
+    else
+    {
+        while ((wanted == NULL || left > 0) && reader->next())
+        {
+            if (wanted)
+            {
+                if ((i = wanted->find(reader->archive_entry_pathname())) == wanted->end())
+                    continue;
+
+                entry = i->second;
+                --left;
+            }
+            else if (!(entry = find(reader->archive_entry_pathname())).isValid() || !sink.accept(entry))
+                continue;
+
+            for (offset = 0; (size = reader->readBlock(buffer, BufferSize, data, offset)) > 0; offset += size)
+                if (!sink.write(entry, data, size, offset))
+                {
+                    res = false;
+                    break;
+                }
+
+            /* Data cut short is not handed over as a complete entry. */
+            if (res && reader->error() != 0)
+            {
+                m_error = Error(reader->error());
+                res = false;
+                break;
             }
-            else
+
+            if (!res || !(res = sink.done(entry)))
             {
-                reader->close();
-                reader.reset();
+                m_error = Error(ECANCELED);
                 break;
             }
-        while(true);
+        }
+
+        /* Entries stopped by a damaged header, not by the end of the archive. */
+        if (res && reader->error() != 0)
+        {
+            m_error = Error(reader->error());
+            res = false;
+        }
     }
 
-    return true;
+    reader->close();
+    reader.reset();
+    m_pool->release(slot);
+    ::free(buffer);
+
+    return res;
+}
+
+
+Archive::Pool::Pool(const ReaderHolder &reader, const char *identity) :
+    m_identity(identity ? ::strdup(identity) : NULL),
+    m_count(1),
+    m_used(0)
+{
+    ASSERT(reader.isValid());
+    ::pthread_mutex_init(&m_mutex, NULL);
+    ::pthread_cond_init(&m_cond, NULL);
+
+    m_readers[0] = reader;
+
+    if (m_identity)
+        m_readers[0]->setIdentity(m_identity);
+
+    for (uint32_t i = 0; i < MaxReaders; ++i)
+        m_busy[i] = false;
+}
+
+Archive::Pool::~Pool()
+{
+    ::free(m_identity);
+    ::pthread_cond_destroy(&m_cond);
+    ::pthread_mutex_destroy(&m_mutex);
+}
+
+Archive::ReaderHolder Archive::Pool::acquire(uint32_t index, uint32_t &slot, Use use)
+{
+    ReaderHolder res;
+
+    ::pthread_mutex_lock(&m_mutex);
+
+    do
+    {
+        uint32_t forward = MaxReaders;
+        slot = MaxReaders;
+
+        /* Prefer a reader which can reach the entry by going forward. */
+        for (uint32_t i = 0; i < m_count && (use == Reserved || m_used < MaxReaders - 1); ++i)
+            if (!m_busy[i])
+            {
+                if (slot == MaxReaders)
+                    slot = i;
+
+                if (m_readers[i]->isOpen() && m_readers[i]->index() <= index &&
+                    (forward == MaxReaders || m_readers[i]->index() > m_readers[forward]->index()))
+                {
+                    forward = i;
+                }
+            }
+
+        if (forward != MaxReaders)
+            slot = forward;
+
+        if (slot == MaxReaders && m_count < MaxReaders && (use == Reserved || m_used < MaxReaders - 1))
+        {
+            m_readers[m_count].reset(m_readers[0]->clone());
+
+            if (UNLIKELY(m_readers[m_count].isValid() == false))
+                break;
+
+            if (m_identity)
+                m_readers[m_count]->setIdentity(m_identity);
+
+            slot = m_count++;
+        }
+
+        if (slot != MaxReaders)
+        {
+            m_busy[slot] = true;
+            ++m_used;
+            res = m_readers[slot];
+            break;
+        }
+
+        if (use == Spare)
+            break;
+
+        ::pthread_cond_wait(&m_cond, &m_mutex);
+    }
+    while (true);
+
+    ::pthread_mutex_unlock(&m_mutex);
+    return res;
+}
+
+void Archive::Pool::release(uint32_t slot)
+{
+    ASSERT(slot < m_count);
+    ::pthread_mutex_lock(&m_mutex);
+    m_busy[slot] = false;
+    --m_used;
+
+    /* Waiting streams may not take the reader a waiting extraction can. */
+    ::pthread_cond_broadcast(&m_cond);
+    ::pthread_mutex_unlock(&m_mutex);
 }
 
 
 Archive::Reader::Reader(const Interface::Holder &file, const char *password) :
     m_file(file),
-    m_password(password ? ::strdup(password) : NULL)
+    m_password(password ? ::strdup(password) : NULL),
+    m_identity(NULL),
+    m_index(0),
+    m_error(0)
 {}
 
 Archive::Reader::~Reader()
 {
     if (m_password)
         ::free(m_password);
+
+    ::free(m_identity);
+}
+
+bool Archive::Reader::openListing()
+{
+    return false;
+}
+
+size_t Archive::Reader::readBlock(void *buffer, size_t size, const void *&data, int64_t &offset)
+{
+    data = buffer;
+    return read(buffer, size);
+}
+
+bool Archive::Reader::seek(int64_t offset)
+{
+    return false;
+}
+
+bool Archive::Reader::direct()
+{
+    return false;
+}
+
+bool Archive::Reader::archive_entry_sparse() const
+{
+    return false;
+}
+
+const char *Archive::Reader::archive_entry_symlink() const
+{
+    return NULL;
+}
+
+bool Archive::Reader::locate(const char *path, uint32_t index, int64_t offset)
+{
+    if (!isOpen() || m_index > index)
+    {
+        close();
+
+        if (!open())
+            return false;
+
+        m_index = 0;
+    }
+
+    while (next())
+        if (m_index++ >= index && ::strcmp(path, archive_entry_pathname()) == 0)
+            return true;
+        else if (m_identity != NULL && block(m_index - 1) != NoBlock && block(m_index - 1) == block(index))
+            keep();
+
+    close();
+    return false;
+}
+
+bool Archive::Reader::independent() const
+{
+    return false;
+}
+
+uint32_t Archive::Reader::block(uint32_t index) const
+{
+    return NoBlock;
+}
+
+void Archive::Reader::setIdentity(const char *value)
+{
+    ::free(m_identity);
+    m_identity = ::strdup(value);
+}
+
+void Archive::Reader::keep()
+{
+    ContentCache &cache = ContentCache::instance();
+    int64_t size = archive_entry_size();
+    ContentCache::Content *content;
+    int64_t position = 0;
+    size_t res;
+
+    if (size <= 0 || size > cache.maxEntrySize())
+        return;
+
+    if ((content = cache.find(m_identity, archive_entry_pathname())) != NULL)
+    {
+        cache.release(content);
+        return;
+    }
+
+    /* Data is decoded anyway, next() would only throw it away. */
+    if ((content = cache.create(size)) == NULL)
+        return;
+
+    for (; position < size; position += res)
+        if ((res = read(content->data() + position, size - position)) == 0)
+            break;
+
+    if (position == size)
+        cache.insert(m_identity, archive_entry_pathname(), content);
+
+    cache.release(content);
 }
 
 void Archive::Reader::setPassword(const char *value)
@@ -25,6 +25,10 @@
 #include <efc/Holder>
 #include <lvfs/IDirectory>
 #include <lvfs-arc/IArchive>
+#include <pthread.h>
+
+#include "lvfs_arc_IndexCache.h"
+#include "lvfs_arc_Listing.h"
 
 
 namespace LVFS {
@@ -39,11 +43,15 @@ public:
     class PLATFORM_MAKE_PRIVATE Reader;
     typedef ::EFC::Holder<Reader> ReaderHolder;
 
+    class PLATFORM_MAKE_PRIVATE Pool;
+    typedef ::EFC::Holder<Pool> PoolHolder;
+
 public:
     Archive(const Interface::Holder &file);
     virtual ~Archive();
 
 public: /* IDirectory */
+    virtual const_iterator begin() const;
     virtual const_iterator end() const;
 
     virtual bool exists(const char *name) const;
@@ -57,16 +65,58 @@ public: /* IArchive */
     virtual const char *password() const;
     virtual void setPassword(const char *value);
 
+    virtual bool refresh();
+
+    virtual bool extract(Sink &sink);
+    virtual bool extract(const Interface::Holder *entries, size_t count, Sink &sink);
+    virtual bool extractParallel(Sink &sink, const Interface::Holder *entries = NULL, size_t count = 0);
+
+    virtual bool scan(Listener &listener);
+    virtual bool scanAsync(Completion &completion, Listener *listener = NULL);
+    virtual void cancel();
+
 public: /* COMMON */
     virtual const Error &lastError() const;
 
 protected:
-    const Entries &entries() const { return m_entries; }
-    bool process(ReaderHolder &reader);
+    virtual ReaderHolder createReader() const = 0;
+
+    bool update(Listener *listener = NULL);
+    bool load(const PoolHolder &pool, const Listing::Holder &listing, Listener *listener = NULL);
+    bool process(const PoolHolder &pool, const Listing::Holder &listing, IndexCache *cache = NULL, Listener *listener = NULL);
 
 private:
+    class ScanTask;
+    class Extraction;
+    bool list(Listener &listener);
+    bool report(const PoolHolder &pool, const Listing::Holder &listing, Listener &listener, uint32_t record);
+    Interface::Holder find(const char *path) const;
+    bool unpack(const Entries *wanted, Sink &sink);
+
+    inline bool cancelled() const { return __atomic_load_n(&m_cancel, __ATOMIC_ACQUIRE); }
+    inline void setCancelled(bool value) { __atomic_store_n(&m_cancel, value, __ATOMIC_RELEASE); }
+
+private:
+    /* Guards the listing state below, a scan updates it on a thread of ScanPool. */
+    mutable pthread_mutex_t m_mutex;
     char *m_password;
     Entries m_entries;
+    Entries m_contents;
+    Listing::Holder m_listing;
+    PoolHolder m_pool;
+    bool m_loaded;
+    bool m_materialized;
+    int64_t m_size;
+    struct timespec m_mTime;
+
+    /* Set from any thread, accessed through cancelled() and setCancelled(). */
+    bool m_cancel;
+
+    /* Guarded by a lock shared with scan tasks, they may outlive the archive. */
+    pthread_cond_t m_scanCond;
+    ScanTask *m_scan;
+    pthread_t m_scanThread;
+    bool m_scanStarted;
     mutable Error m_error;
     mutable const Error *m_lastError;
 };
@@ -77,15 +127,51 @@ class PLATFORM_MAKE_PRIVATE Archive::Reader : public ReaderHolder::Data
 public:
     typedef ReaderHolder Holder;
 
+    enum
+    {
+        /* Position in the archive is unknown, locate() starts over. */
+        NoIndex = 0xFFFFFFFF,
+        NoBlock = 0xFFFFFFFF
+    };
+
 public:
     Reader(const Interface::Holder &file, const char *password);
     virtual ~Reader();
 
+    virtual Reader *clone() const = 0;
+
     virtual bool isOpen() const = 0;
     virtual bool open() = 0;
+
+    /* Opens for listing from the archive's own directory, entries can not be read. */
+    virtual bool openListing();
     virtual size_t read(void *buffer, size_t size) = 0;
+
+    /*
+     * Next span of data of the current entry, not to be mixed with read() for one entry.
+     * Data points into the archive where possible, into buffer otherwise. Offset
+     * is the end of the previous span on input and where this one starts on output,
+     * gaps between spans are holes of sparse entries.
+     */
+    virtual size_t readBlock(void *buffer, size_t size, const void *&data, int64_t &offset);
+    virtual bool seek(int64_t offset);
+
+    /* Data of the current entry is stored as is and read straight from the archive file. */
+    virtual bool direct();
     virtual void close() = 0;
     virtual bool next() = 0;
+    virtual bool locate(const char *path, uint32_t index, int64_t offset);
+
+    /* Every entry can be located by its offset without reading the ones before it. */
+    virtual bool independent() const;
+
+    /*
+     * Solid block of an entry, NoBlock if the entry is decoded on its own or
+     * its block is not known (7z header that could not be read). Entries of
+     * one block are decoded one after another, so the ones passed by locate()
+     * on the way to an entry of their block are kept in ContentCache.
+     */
+    virtual uint32_t block(uint32_t index) const;
 
     virtual const char *archive_entry_pathname() const = 0;
     virtual time_t archive_entry_ctime() const = 0;
@@ -93,6 +179,19 @@ public:
     virtual time_t archive_entry_atime() const = 0;
     virtual mode_t archive_entry_perm() const = 0;
     virtual int64_t archive_entry_size() const = 0;
+    virtual int64_t archive_entry_offset() const = 0;
+    virtual bool archive_entry_sparse() const;
+
+    /* Target of a symbolic link entry, NULL for other entries. */
+    virtual const char *archive_entry_symlink() const;
+
+    inline uint32_t index() const { return m_index; }
+
+    /* Key of the archive in ContentCache, nothing is kept without it. */
+    void setIdentity(const char *value);
+
+    /* Error which stopped the last next(), read() or readBlock(), 0 if entries or data just ran out. */
+    inline int error() const { return m_error; }
 
 protected:
     inline const Interface::Holder &file() const { return m_file; }
@@ -100,9 +199,63 @@ protected:
     inline const char *password() const { return m_password; }
     void setPassword(const char *value);
 
+    inline void setIndex(uint32_t value) { m_index = value; }
+    inline void setError(int value) { m_error = value; }
+
+private:
+    void keep();
+
 private:
     Interface::Holder m_file;
     char *m_password;
+    char *m_identity;
+    uint32_t m_index;
+    int m_error;
+};
+
+
+/**
+ * Independent readers of one archive.
+ *
+ * Every opened entry owns a reader until its stream is destroyed, so
+ * entries can be read concurrently. Number of readers (and so of open
+ * files) is limited by MaxReaders, acquire() waits for a free one. The
+ * last one is left for listing and extraction, so streams held by the
+ * caller of extract() or refresh() do not keep it waiting forever.
+ */
+class PLATFORM_MAKE_PRIVATE Archive::Pool : public PoolHolder::Data
+{
+    PLATFORM_MAKE_NONCOPYABLE(Pool)
+
+public:
+    typedef PoolHolder Holder;
+    enum { MaxReaders = 8 };
+
+    enum Use
+    {
+        Stream,   /* Opened entry, waits for any reader but the last one. */
+        Reserved, /* Listing and extraction, waits for any reader. */
+        Spare     /* Extra extraction worker, does not wait. */
+    };
+
+public:
+    Pool(const ReaderHolder &reader, const char *identity);
+    virtual ~Pool();
+
+    /* Key of this version of the archive in ContentCache, NULL if unknown. */
+    inline const char *identity() const { return m_identity; }
+
+    ReaderHolder acquire(uint32_t index, uint32_t &slot, Use use = Stream);
+    void release(uint32_t slot);
+
+private:
+    char *m_identity;
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+    ReaderHolder m_readers[MaxReaders];
+    bool m_busy[MaxReaders];
+    uint32_t m_count;
+    uint32_t m_used;
 };
 
 }}
@@ -0,0 +1,266 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lvfs_arc_ContentCache.h"
+
+#include <brolly/assert.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+namespace LVFS {
+namespace Arc {
+
+namespace {
+    inline uint64_t fnv1a(uint64_t hash, const char *string)
+    {
+        for (; *string; ++string)
+            hash = (hash ^ static_cast<unsigned char>(*string)) * 1099511628211ULL;
+
+        return hash;
+    }
+
+    inline uint64_t hash(const char *archive, const char *path)
+    {
+        return fnv1a(fnv1a(14695981039346656037ULL, archive) * 1099511628211ULL, path);
+    }
+
+    inline bool matches(const char *key, const char *archive, const char *path)
+    {
+        return ::strcmp(key, archive) == 0 && ::strcmp(key + ::strlen(key) + 1, path) == 0;
+    }
+}
+
+
+ContentCache::Content::Content() :
+    m_data(NULL),
+    m_size(0),
+    m_mapped(false),
+    m_refs(1),
+    m_hash(0),
+    m_key(NULL),
+    m_bucket(NULL),
+    m_prev(NULL),
+    m_next(NULL)
+{}
+
+ContentCache::Content::~Content()
+{
+    if (m_mapped)
+        ::munmap(m_data, m_size);
+    else
+        ::free(m_data);
+
+    ::free(m_key);
+}
+
+
+ContentCache::ContentCache() :
+    m_budget(static_cast<int64_t>(DefaultBudget) * 1024 * 1024),
+    m_used(0),
+    m_head(NULL),
+    m_tail(NULL)
+{
+    const char *value = ::getenv("LVFS_ARC_CACHE_SIZE");
+
+    if (value != NULL && *value != 0)
+        m_budget = static_cast<int64_t>(::strtoul(value, NULL, 10)) * 1024 * 1024;
+
+    ::memset(m_buckets, 0, sizeof(m_buckets));
+    ::pthread_mutex_init(&m_mutex, NULL);
+}
+
+ContentCache::~ContentCache()
+{
+    while (m_head != NULL)
+        unlink(m_head);
+
+    ::pthread_mutex_destroy(&m_mutex);
+}
+
+ContentCache &ContentCache::instance()
+{
+    static ContentCache cache;
+    return cache;
+}
+
+ContentCache::Content *ContentCache::find(const char *archive, const char *path)
+{
+    uint64_t key = hash(archive, path);
+    Content *res;
+
+    if (m_budget == 0)
+        return NULL;
+
+    ::pthread_mutex_lock(&m_mutex);
+
+    for (res = m_buckets[key % Buckets]; res != NULL; res = res->m_bucket)
+        if (res->m_hash == key && matches(res->m_key, archive, path))
+        {
+            /* Move to the head of the LRU list. */
+            if (res != m_head)
+            {
+                res->m_prev->m_next = res->m_next;
+
+                if (res->m_next)
+                    res->m_next->m_prev = res->m_prev;
+                else
+                    m_tail = res->m_prev;
+
+                res->m_prev = NULL;
+                res->m_next = m_head;
+                m_head->m_prev = res;
+                m_head = res;
+            }
+
+            ++res->m_refs;
+            break;
+        }
+
+    ::pthread_mutex_unlock(&m_mutex);
+    return res;
+}
+
+ContentCache::Content *ContentCache::create(int64_t size)
+{
+    Content *res;
+
+    if (size <= 0 || size > maxEntrySize() || (res = new (std::nothrow) Content()) == NULL)
+        return NULL;
+
+    res->m_size = size;
+
+#ifdef MFD_CLOEXEC
+    if (size >= SpillSize)
+    {
+        int fd = ::memfd_create("lvfs-arc", MFD_CLOEXEC);
+
+        if (fd != -1)
+        {
+            void *data;
+
+            if (::ftruncate(fd, size) == 0 &&
+                (data = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) != MAP_FAILED)
+            {
+                res->m_data = static_cast<unsigned char *>(data);
+                res->m_mapped = true;
+            }
+
+            ::close(fd);
+        }
+    }
+#endif
+
+    if (res->m_data == NULL && (res->m_data = static_cast<unsigned char *>(::malloc(size))) == NULL)
+    {
+        delete res;
+        return NULL;
+    }
+
+    return res;
+}
+
+void ContentCache::insert(const char *archive, const char *path, Content *content)
+{
+    size_t archiveLen = ::strlen(archive) + 1;
+    size_t pathLen = ::strlen(path) + 1;
+    Content **bucket;
+
+    ASSERT(content->m_key == NULL);
+
+    if (UNLIKELY((content->m_key = static_cast<char *>(::malloc(archiveLen + pathLen))) == NULL))
+        return;
+
+    ::memcpy(content->m_key, archive, archiveLen);
+    ::memcpy(content->m_key + archiveLen, path, pathLen);
+    content->m_hash = hash(archive, path);
+
+    ::pthread_mutex_lock(&m_mutex);
+
+    /* Someone could have cached the same entry meanwhile. */
+    for (bucket = &m_buckets[content->m_hash % Buckets]; *bucket != NULL; bucket = &(*bucket)->m_bucket)
+        if ((*bucket)->m_hash == content->m_hash && matches((*bucket)->m_key, archive, path))
+        {
+            unlink(*bucket);
+            break;
+        }
+
+    ++content->m_refs;
+    content->m_bucket = m_buckets[content->m_hash % Buckets];
+    m_buckets[content->m_hash % Buckets] = content;
+
+    content->m_next = m_head;
+
+    if (m_head)
+        m_head->m_prev = content;
+    else
+        m_tail = content;
+
+    m_head = content;
+    m_used += content->m_size;
+
+    while (m_used > m_budget)
+        unlink(m_tail);
+
+    ::pthread_mutex_unlock(&m_mutex);
+}
+
+void ContentCache::release(Content *content)
+{
+    ::pthread_mutex_lock(&m_mutex);
+    unref(content);
+    ::pthread_mutex_unlock(&m_mutex);
+}
+
+void ContentCache::unlink(Content *content)
+{
+    Content **bucket;
+
+    for (bucket = &m_buckets[content->m_hash % Buckets]; *bucket != content; bucket = &(*bucket)->m_bucket)
+        ASSERT(*bucket != NULL);
+
+    *bucket = content->m_bucket;
+
+    if (content->m_prev)
+        content->m_prev->m_next = content->m_next;
+    else
+        m_head = content->m_next;
+
+    if (content->m_next)
+        content->m_next->m_prev = content->m_prev;
+    else
+        m_tail = content->m_prev;
+
+    m_used -= content->m_size;
+
+    /* Streams still reading it keep the content alive. */
+    unref(content);
+}
+
+void ContentCache::unref(Content *content)
+{
+    if (--content->m_refs == 0)
+        delete content;
+}
+
+}}
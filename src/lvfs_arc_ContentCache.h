@@ -0,0 +1,105 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LVFS_ARC_CONTENTCACHE_H_
+#define LVFS_ARC_CONTENTCACHE_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+namespace LVFS {
+namespace Arc {
+
+/**
+ * Process-wide LRU cache of decompressed entries.
+ *
+ * Contents are keyed by the identity of the archive (location, size and
+ * modification time) and the path of the entry. Small contents live on the
+ * heap, bigger ones (SpillSize and above) in memfd(2) mappings. Budget is
+ * taken from LVFS_ARC_CACHE_SIZE (MiB), 0 disables the cache.
+ */
+class PLATFORM_MAKE_PRIVATE ContentCache
+{
+    PLATFORM_MAKE_NONCOPYABLE(ContentCache)
+
+public:
+    class Content
+    {
+        PLATFORM_MAKE_NONCOPYABLE(Content)
+
+    public:
+        inline unsigned char *data() const { return m_data; }
+        inline size_t size() const { return m_size; }
+
+    private:
+        friend class ContentCache;
+
+        Content();
+        ~Content();
+
+    private:
+        unsigned char *m_data;
+        size_t m_size;
+        bool m_mapped;
+        uint32_t m_refs;
+        uint64_t m_hash;
+        char *m_key;
+        Content *m_bucket;
+        Content *m_prev;
+        Content *m_next;
+    };
+
+    enum
+    {
+        DefaultBudget = 64,
+        SpillSize = 256 * 1024,
+        Buckets = 1024
+    };
+
+public:
+    static ContentCache &instance();
+
+    inline int64_t maxEntrySize() const { return m_budget / 8; }
+
+    Content *find(const char *archive, const char *path);
+    Content *create(int64_t size);
+    void insert(const char *archive, const char *path, Content *content);
+    void release(Content *content);
+
+private:
+    ContentCache();
+    ~ContentCache();
+
+    void unlink(Content *content);
+    void unref(Content *content);
+
+private:
+    pthread_mutex_t m_mutex;
+    int64_t m_budget;
+    int64_t m_used;
+    Content *m_buckets[Buckets];
+    Content *m_head;
+    Content *m_tail;
+};
+
+}}
+
+#endif /* LVFS_ARC_CONTENTCACHE_H_ */
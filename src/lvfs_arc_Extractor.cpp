@@ -0,0 +1,622 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lvfs_arc_Extractor.h"
+
+#include <brolly/assert.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+namespace LVFS {
+namespace Arc {
+
+struct Extractor::Chunk
+{
+    enum Type
+    {
+        Begin,
+        BeginSparse,
+        Data,
+        End,
+        EndSparse,
+
+        /* Symbolic link, buffer is its target and is not one of the buffers. */
+        Link,
+
+        /* Entry is cut short by a read error, size is the error. */
+        Fail
+    };
+
+    int type;
+    uint32_t record;
+    char *buffer;
+    size_t size;
+    int64_t offset;
+    Chunk *next;
+};
+
+
+Extractor::Extractor(const Archive::Pool::Holder &pool, const Listing::Holder &listing, uint32_t root, uint32_t base,
+                     const char *destination, const IDirectory::Progress &progress, mode_t mode) :
+    m_pool(pool),
+    m_listing(listing),
+    m_root(root),
+    m_base(base),
+    m_destination(::strdup(destination)),
+    m_progress(progress),
+    m_mode(mode),
+    m_wanted(NULL),
+    m_head(NULL),
+    m_tail(NULL),
+    m_queued(0),
+    m_freeCount(0),
+    m_finished(false),
+    m_errno(0),
+    m_buffer(NULL),
+    m_fill(0),
+    m_start(0)
+{
+    ::pthread_mutex_init(&m_mutex, NULL);
+    ::pthread_cond_init(&m_cond, NULL);
+
+    for (uint32_t i = 0; i < Buffers; ++i)
+        m_buffers[i] = NULL;
+}
+
+Extractor::~Extractor()
+{
+    for (Chunk *chunk; (chunk = m_head) != NULL; m_head = chunk->next)
+    {
+        if (chunk->type == Chunk::Link)
+            ::free(chunk->buffer);
+
+        delete chunk;
+    }
+
+    for (uint32_t i = 0; i < Buffers; ++i)
+        ::free(m_buffers[i]);
+
+    delete [] m_wanted;
+    ::free(m_destination);
+    ::pthread_cond_destroy(&m_cond);
+    ::pthread_mutex_destroy(&m_mutex);
+}
+
+bool Extractor::run()
+{
+    Archive::Reader::Holder reader;
+    pthread_t thread;
+    uint32_t record;
+    uint32_t slot;
+    void *buffer;
+    bool decoded = true;
+
+    if (UNLIKELY(m_destination == NULL))
+    {
+        m_errno = ENOMEM;
+        return false;
+    }
+
+    for (uint32_t i = 0; i < Buffers; ++i)
+        if (::posix_memalign(&buffer, Alignment, BufferSize) != 0)
+        {
+            m_errno = ENOMEM;
+            return false;
+        }
+        else
+            m_free[m_freeCount++] = m_buffers[i] = static_cast<char *>(buffer);
+
+    if (!prepare())
+        return false;
+
+    if (::pthread_create(&thread, NULL, writer, this) != 0)
+    {
+        m_errno = EAGAIN;
+        return false;
+    }
+
+    if (LIKELY((reader = m_pool->acquire(0, slot, Archive::Pool::Reserved)).isValid() == true))
+    {
+        if (reader->isOpen())
+            reader->close();
+
+        /* One pass in the archive order. */
+        if (reader->open())
+        {
+            while (reader->next())
+                if ((record = m_listing->find(reader->archive_entry_pathname())) != Listing::None &&
+                    m_wanted[record] && !m_listing->isDir(record) && !(decoded = decode(reader, record)))
+                {
+                    break;
+                }
+
+            /* Entries stopped by a damaged header, not by the end of the archive. */
+            if (decoded && reader->error() != 0)
+                push(Chunk::Fail, m_root, NULL, reader->error(), 0);
+
+            reader->close();
+        }
+        else
+            fail(EIO);
+
+        reader.reset();
+        m_pool->release(slot);
+    }
+    else
+        fail(ENOMEM);
+
+    ::pthread_mutex_lock(&m_mutex);
+    m_finished = true;
+    ::pthread_cond_broadcast(&m_cond);
+    ::pthread_mutex_unlock(&m_mutex);
+
+    ::pthread_join(thread, NULL);
+    return m_errno == 0;
+}
+
+void *Extractor::writer(void *extractor)
+{
+    static_cast<Extractor *>(extractor)->write();
+    return NULL;
+}
+
+void Extractor::write()
+{
+    Chunk *chunk;
+    int fd = -1;
+    int error;
+
+    ::pthread_mutex_lock(&m_mutex);
+
+    for (;;)
+    {
+        while (m_head == NULL && !m_finished)
+            ::pthread_cond_wait(&m_cond, &m_mutex);
+
+        if ((chunk = m_head) == NULL)
+            break;
+
+        if ((m_head = chunk->next) == NULL)
+            m_tail = NULL;
+
+        --m_queued;
+        error = m_errno;
+        ::pthread_cond_broadcast(&m_cond);
+        ::pthread_mutex_unlock(&m_mutex);
+
+        /* After an error chunks are only drained, so the decoder does not block. */
+        if (error == 0)
+            process(chunk, fd);
+
+        ::pthread_mutex_lock(&m_mutex);
+
+        if (chunk->type == Chunk::Link)
+            ::free(chunk->buffer);
+        else if (chunk->buffer)
+        {
+            m_free[m_freeCount++] = chunk->buffer;
+            ::pthread_cond_broadcast(&m_cond);
+        }
+
+        delete chunk;
+    }
+
+    ::pthread_mutex_unlock(&m_mutex);
+
+    if (fd >= 0)
+        ::close(fd);
+}
+
+void Extractor::process(Chunk *chunk, int &fd)
+{
+    const Listing::Record &record = m_listing->record(chunk->record);
+    struct timespec times[2];
+    char *path;
+    ssize_t res;
+
+    switch (chunk->type)
+    {
+        case Chunk::Begin:
+        case Chunk::BeginSparse:
+            if (fd >= 0)
+                ::close(fd);
+
+            /* Entries with names leading out of the destination are skipped. */
+            if ((path = target(chunk->record)) == NULL)
+            {
+                fd = -1;
+                break;
+            }
+
+            /* A link of an earlier entry with the same name is replaced, not followed. */
+            if ((fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600)) < 0 &&
+                (errno != ELOOP || ::unlink(path) != 0 ||
+                 (fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600)) < 0))
+            {
+                fail(errno);
+            }
+            else if (chunk->type == Chunk::Begin && record.size > 0 &&
+                     ::fallocate(fd, 0, 0, record.size) != 0 && errno == ENOSPC)
+            {
+                fail(errno);
+            }
+
+            ::free(path);
+            break;
+
+        case Chunk::Data:
+            if (fd < 0)
+                break;
+
+            for (size_t done = 0; done < chunk->size; done += res)
+                if ((res = ::pwrite(fd, chunk->buffer + done, chunk->size - done, chunk->offset + done)) < 0)
+                    if (errno == EINTR)
+                        res = 0;
+                    else
+                    {
+                        fail(errno);
+                        break;
+                    }
+
+            break;
+
+        case Chunk::End:
+        case Chunk::EndSparse:
+            if (fd < 0)
+                break;
+
+            times[0].tv_sec = record.aTime ? record.aTime : record.mTime;
+            times[0].tv_nsec = 0;
+            times[1].tv_sec = record.mTime;
+            times[1].tv_nsec = 0;
+
+            /* Holes at the end of sparse entries are not written. */
+            if ((chunk->type == Chunk::EndSparse && ::ftruncate(fd, record.size) != 0) ||
+                (record.perm && ::fchmod(fd, record.perm & m_mode) != 0) ||
+                (record.mTime && ::futimens(fd, times) != 0))
+            {
+                fail(errno);
+            }
+
+            if (::close(fd) != 0)
+                fail(errno);
+
+            fd = -1;
+            break;
+
+        case Chunk::Link:
+            if (fd >= 0)
+                ::close(fd);
+
+            fd = -1;
+
+            if ((path = target(chunk->record)) == NULL)
+                break;
+
+            times[0].tv_sec = record.aTime ? record.aTime : record.mTime;
+            times[0].tv_nsec = 0;
+            times[1].tv_sec = record.mTime;
+            times[1].tv_nsec = 0;
+
+            /* Links get no permissions, they are not followed for the times. */
+            if ((::unlink(path) != 0 && errno != ENOENT) ||
+                ::symlink(chunk->buffer, path) != 0 ||
+                (record.mTime && ::utimensat(AT_FDCWD, path, times, AT_SYMLINK_NOFOLLOW) != 0))
+            {
+                fail(errno);
+            }
+
+            ::free(path);
+            break;
+
+        case Chunk::Fail:
+            /*
+             * Failed after the data of the entries before it is written, a file
+             * left preallocated would pass for a complete one.
+             */
+            if (fd >= 0)
+            {
+                ::close(fd);
+                fd = -1;
+
+                if ((path = target(chunk->record)) != NULL)
+                {
+                    ::unlink(path);
+                    ::free(path);
+                }
+            }
+
+            fail(static_cast<int>(chunk->size));
+            break;
+    }
+}
+
+bool Extractor::prepare()
+{
+    uint32_t count = m_listing->count();
+    char *path;
+
+    if (UNLIKELY((m_wanted = new (std::nothrow) bool[count]) == NULL))
+    {
+        m_errno = ENOMEM;
+        return false;
+    }
+
+    /* Parents are always added to the listing before their children. */
+    for (uint32_t i = 0; i < count; ++i)
+        m_wanted[i] = i == m_root || (i != Listing::Root && m_wanted[m_listing->record(i).parent]);
+
+    /* Directories are made at once, before anything is decoded. */
+    for (uint32_t i = 0; i < count; ++i)
+        if (m_wanted[i] && m_listing->isDir(i) && i != m_base)
+        {
+            if ((path = target(i)) == NULL)
+            {
+                m_wanted[i] = false;
+                continue;
+            }
+
+            if (::mkdir(path, 0755) != 0 && errno != EEXIST)
+            {
+                m_errno = errno;
+                ::free(path);
+                return false;
+            }
+
+            ::free(path);
+        }
+
+    return true;
+}
+
+char *Extractor::target(uint32_t record) const
+{
+    size_t size = ::strlen(m_destination) + 1;
+    const char *name;
+    size_t len;
+    char *res;
+
+    for (uint32_t i = record; i != m_base; i = m_listing->record(i).parent)
+    {
+        name = m_listing->name(i);
+
+        if (name[0] == 0 || ::strcmp(name, ".") == 0 || ::strcmp(name, "..") == 0)
+            return NULL;
+
+        size += ::strlen(name) + 1;
+    }
+
+    if (UNLIKELY((res = static_cast<char *>(::malloc(size))) == NULL))
+        return NULL;
+
+    res[--size] = 0;
+
+    for (uint32_t i = record; i != m_base; i = m_listing->record(i).parent)
+    {
+        len = ::strlen(m_listing->name(i));
+        size -= len;
+        ::memcpy(res + size, m_listing->name(i), len);
+        res[--size] = '/';
+    }
+
+    ::memcpy(res, m_destination, size);
+    return res;
+}
+
+bool Extractor::decode(const Archive::Reader::Holder &reader, uint32_t record)
+{
+    const void *data;
+    int64_t offset = 0;
+    size_t size;
+    bool sparse = reader->archive_entry_sparse();
+    const char *link = reader->archive_entry_symlink();
+    char *buffer;
+
+    /* Made by the writer, the link is not opened as a file. */
+    if (link != NULL)
+    {
+        if (UNLIKELY((buffer = ::strdup(link)) == NULL))
+        {
+            fail(ENOMEM);
+            return false;
+        }
+
+        if (!push(Chunk::Link, record, buffer, 0, 0))
+        {
+            ::free(buffer);
+            return false;
+        }
+
+        return true;
+    }
+
+    if (!push(sparse ? Chunk::BeginSparse : Chunk::Begin, record, NULL, 0, 0))
+        return false;
+
+    if (m_progress.init)
+        m_progress.init(m_progress.arg, m_listing->name(record), m_listing->record(record).size);
+
+    for (;;)
+    {
+        if (m_buffer != NULL && m_fill == BufferSize && !flush(record))
+            return false;
+
+        if (m_buffer == NULL && (m_buffer = take()) == NULL)
+            return false;
+
+        /* Data which is not in the archive already is read right into the buffer. */
+        if ((size = reader->readBlock(m_buffer + m_fill, BufferSize - m_fill, data, offset)) == 0)
+        {
+            if (reader->error() == 0)
+                break;
+
+            push(Chunk::Fail, record, NULL, reader->error(), 0);
+            return false;
+        }
+
+        if (!append(static_cast<const char *>(data), size, offset, record))
+            return false;
+
+        offset += size;
+
+        if (m_progress.update)
+            m_progress.update(m_progress.arg, offset);
+    }
+
+    /* Only sparse entries may end with a hole. */
+    if (!sparse && offset < m_listing->record(record).size)
+    {
+        push(Chunk::Fail, record, NULL, EIO, 0);
+        return false;
+    }
+
+    if (!flush(record) || !push(sparse ? Chunk::EndSparse : Chunk::End, record, NULL, 0, 0))
+        return false;
+
+    if (m_progress.complete)
+        m_progress.complete(m_progress.arg);
+
+    return true;
+}
+
+bool Extractor::append(const char *data, size_t size, int64_t offset, uint32_t record)
+{
+    size_t len;
+
+    while (size > 0)
+    {
+        if (m_buffer == NULL && (m_buffer = take()) == NULL)
+            return false;
+
+        if (m_fill == 0)
+            m_start = offset;
+        else if (offset != m_start + static_cast<int64_t>(m_fill) || m_fill == BufferSize)
+        {
+            if (!flush(record))
+                return false;
+
+            continue;
+        }
+
+        len = size < BufferSize - m_fill ? size : BufferSize - m_fill;
+
+        if (data != m_buffer + m_fill)
+            ::memcpy(m_buffer + m_fill, data, len);
+
+        m_fill += len;
+        data += len;
+        offset += len;
+        size -= len;
+    }
+
+    return true;
+}
+
+bool Extractor::flush(uint32_t record)
+{
+    char *buffer = m_buffer;
+    size_t size = m_fill;
+
+    if (buffer == NULL || size == 0)
+        return true;
+
+    m_buffer = NULL;
+    m_fill = 0;
+
+    return push(Chunk::Data, record, buffer, size, m_start);
+}
+
+bool Extractor::push(int type, uint32_t record, char *buffer, size_t size, int64_t offset)
+{
+    Chunk *chunk = new (std::nothrow) Chunk;
+
+    if (UNLIKELY(chunk == NULL))
+    {
+        fail(ENOMEM);
+        return false;
+    }
+
+    chunk->type = type;
+    chunk->record = record;
+    chunk->buffer = buffer;
+    chunk->size = size;
+    chunk->offset = offset;
+    chunk->next = NULL;
+
+    ::pthread_mutex_lock(&m_mutex);
+
+    while (m_queued >= MaxChunks && m_errno == 0)
+        ::pthread_cond_wait(&m_cond, &m_mutex);
+
+    if (m_errno != 0)
+    {
+        ::pthread_mutex_unlock(&m_mutex);
+        delete chunk;
+        return false;
+    }
+
+    if (m_tail)
+        m_tail->next = chunk;
+    else
+        m_head = chunk;
+
+    m_tail = chunk;
+    ++m_queued;
+
+    ::pthread_cond_broadcast(&m_cond);
+    ::pthread_mutex_unlock(&m_mutex);
+
+    return true;
+}
+
+char *Extractor::take()
+{
+    char *res = NULL;
+
+    ::pthread_mutex_lock(&m_mutex);
+
+    while (m_freeCount == 0 && m_errno == 0)
+        ::pthread_cond_wait(&m_cond, &m_mutex);
+
+    if (m_errno == 0)
+        res = m_free[--m_freeCount];
+
+    ::pthread_mutex_unlock(&m_mutex);
+    return res;
+}
+
+void Extractor::fail(int error)
+{
+    ::pthread_mutex_lock(&m_mutex);
+
+    if (m_errno == 0)
+        m_errno = error;
+
+    ::pthread_cond_broadcast(&m_cond);
+    ::pthread_mutex_unlock(&m_mutex);
+}
+
+}}
@@ -0,0 +1,111 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LVFS_ARC_EXTRACTOR_H_
+#define LVFS_ARC_EXTRACTOR_H_
+
+#include <lvfs/IDirectory>
+#include <pthread.h>
+#include "lvfs_arc_Archive.h"
+
+
+namespace LVFS {
+namespace Arc {
+
+/**
+ * Unpacks a subtree of an archive into a local directory.
+ *
+ * Data is decoded by the calling thread and written by a thread of the
+ * extractor, the two are connected by a queue of Buffers aligned buffers
+ * of BufferSize bytes. All directories are made before unpacking, files
+ * are preallocated and get their permissions and times through their
+ * descriptors on the writing thread. Only permission bits in mode are
+ * restored, so setuid, setgid and sticky bits are dropped unless asked
+ * for. Symbolic links are made as links, an entry replacing one is not
+ * written through it. A file whose data can not be read to the end is
+ * removed and the extraction fails.
+ */
+class PLATFORM_MAKE_PRIVATE Extractor
+{
+    PLATFORM_MAKE_NONCOPYABLE(Extractor)
+
+public:
+    enum
+    {
+        BufferSize = 1024 * 1024,
+        Buffers = 8,
+        MaxChunks = 64,
+        Alignment = 4096
+    };
+
+public:
+    Extractor(const Archive::Pool::Holder &pool, const Listing::Holder &listing, uint32_t root, uint32_t base,
+              const char *destination, const IDirectory::Progress &progress, mode_t mode = 0777);
+    ~Extractor();
+
+    bool run();
+
+    inline int error() const { return m_errno; }
+
+private:
+    struct Chunk;
+
+    static void *writer(void *extractor);
+    void write();
+    void process(Chunk *chunk, int &fd);
+
+    bool prepare();
+    char *target(uint32_t record) const;
+
+    bool decode(const Archive::Reader::Holder &reader, uint32_t record);
+    bool append(const char *data, size_t size, int64_t offset, uint32_t record);
+    bool flush(uint32_t record);
+    bool push(int type, uint32_t record, char *buffer, size_t size, int64_t offset);
+    char *take();
+    void fail(int error);
+
+private:
+    Archive::Pool::Holder m_pool;
+    Listing::Holder m_listing;
+    uint32_t m_root;
+    uint32_t m_base;
+    char *m_destination;
+    const IDirectory::Progress &m_progress;
+    mode_t m_mode;
+    bool *m_wanted;
+
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+    Chunk *m_head;
+    Chunk *m_tail;
+    uint32_t m_queued;
+    char *m_buffers[Buffers];
+    char *m_free[Buffers];
+    uint32_t m_freeCount;
+    bool m_finished;
+    int m_errno;
+
+    char *m_buffer;
+    size_t m_fill;
+    int64_t m_start;
+};
+
+}}
+
+#endif /* LVFS_ARC_EXTRACTOR_H_ */
@@ -23,6 +23,18 @@
 namespace LVFS {
 namespace Arc {
 
+IArchive::Sink::~Sink()
+{}
+
+
+IArchive::Listener::~Listener()
+{}
+
+
+IArchive::Completion::~Completion()
+{}
+
+
 IArchive::~IArchive()
 {}
 
@@ -30,11 +30,77 @@ class PLATFORM_MAKE_PUBLIC IArchive
 {
     DECLARE_INTERFACE(LVFS::Arc::IArchive)
 
+public:
+    /**
+     * Receiver of entries unpacked by extract().
+     *
+     * Entries are delivered in the order they are stored in the archive.
+     * Holes of sparse entries are not written, offsets skip over them.
+     * Returning false from write() or done() stops the extraction.
+     */
+    class PLATFORM_MAKE_PUBLIC Sink
+    {
+    public:
+        virtual ~Sink();
+
+        virtual bool accept(const Interface::Holder &entry) = 0;
+        virtual bool write(const Interface::Holder &entry, const void *buffer, size_t size, off64_t offset) = 0;
+        virtual bool done(const Interface::Holder &entry) = 0;
+    };
+
+    /**
+     * Receiver of entries found by scan().
+     *
+     * Entries are reported as soon as their headers are read, returning
+     * false from found() stops the scan.
+     */
+    class PLATFORM_MAKE_PUBLIC Listener
+    {
+    public:
+        virtual ~Listener();
+
+        virtual bool found(const Interface::Holder &entry) = 0;
+    };
+
+    /**
+     * Receiver of the result of scanAsync().
+     *
+     * Called on a worker thread, the archive may be destroyed from here.
+     */
+    class PLATFORM_MAKE_PUBLIC Completion
+    {
+    public:
+        virtual ~Completion();
+
+        virtual void completed(IArchive *archive, bool result) = 0;
+    };
+
 public:
     virtual ~IArchive();
 
     virtual const char *password() const = 0;
     virtual void setPassword(const char *value) = 0;
+
+    virtual bool refresh() = 0;
+
+    virtual bool extract(Sink &sink) = 0;
+    virtual bool extract(const Interface::Holder *entries, size_t count, Sink &sink) = 0;
+
+    /**
+     * Same as extract(), but entries stored independently of each other
+     * (zip, uncompressed tar) are unpacked by several threads at once.
+     * Other archives are unpacked by extract().
+     *
+     * Entries come in no particular order. Calls for different entries
+     * may be made concurrently from different threads, calls for one
+     * entry are made in order from one thread. All entries are unpacked
+     * if none are given, accept() is called for them before unpacking.
+     */
+    virtual bool extractParallel(Sink &sink, const Interface::Holder *entries = NULL, size_t count = 0) = 0;
+
+    virtual bool scan(Listener &listener) = 0;
+    virtual bool scanAsync(Completion &completion, Listener *listener = NULL) = 0;
+    virtual void cancel() = 0;
 };
 
 }}
@@ -0,0 +1,458 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lvfs_arc_IndexCache.h"
+
+#include <brolly/assert.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <cstring>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+namespace LVFS {
+namespace Arc {
+
+struct IndexCache::Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    int64_t size;
+    int64_t mTime;
+    int64_t mTimeNsec;
+    uint64_t fingerprint;
+    uint64_t location;
+    uint64_t strings;
+};
+
+struct IndexCache::Record
+{
+    uint64_t path;
+    int64_t size;
+    int64_t offset;
+    int64_t cTime;
+    int64_t mTime;
+    int64_t aTime;
+    uint32_t perm;
+    uint32_t reserved;
+};
+
+namespace {
+    enum
+    {
+        Version = 1,
+        FingerprintSize = 4096,
+        MaxCacheSize = 64 * 1024 * 1024,
+        MaxAge = 90 * 24 * 60 * 60
+    };
+
+    struct CacheFile
+    {
+        char name[NAME_MAX + 1];
+        time_t mTime;
+        off_t size;
+    };
+
+    static const char Magic[8] = { 'L', 'V', 'F', 'S', 'A', 'R', 'C', 0 };
+
+    inline uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+    {
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ p[i]) * 1099511628211ULL;
+
+        return hash;
+    }
+
+    bool cacheDir(char *buffer, size_t size)
+    {
+        const char *base;
+        int res;
+
+        if ((base = ::getenv("XDG_CACHE_HOME")) != NULL && base[0] == '/')
+            res = ::snprintf(buffer, size, "%s", base);
+        else if ((base = ::getenv("HOME")) != NULL && base[0] == '/')
+            res = ::snprintf(buffer, size, "%s/.cache", base);
+        else
+            return false;
+
+        if (res <= 0 || static_cast<size_t>(res) + sizeof("/lvfs-arc") > size)
+            return false;
+
+        if (::mkdir(buffer, 0700) != 0 && errno != EEXIST)
+            return false;
+
+        ::strcat(buffer, "/lvfs-arc");
+        return ::mkdir(buffer, 0700) == 0 || errno == EEXIST;
+    }
+
+    int compareAge(const void *f1, const void *f2)
+    {
+        time_t t1 = static_cast<const CacheFile *>(f1)->mTime;
+        time_t t2 = static_cast<const CacheFile *>(f2)->mTime;
+
+        return t1 < t2 ? -1 : t1 > t2 ? 1 : 0;
+    }
+
+    /*
+     * Listings not used for MaxAge are removed, then the least recently
+     * used ones until the rest fits in MaxCacheSize.
+     */
+    void prune(const char *path)
+    {
+        CacheFile *files = NULL;
+        size_t count = 0;
+        size_t capacity = 0;
+        int64_t total = 0;
+        time_t now = ::time(NULL);
+        struct dirent *entry;
+        struct stat st;
+        DIR *dir;
+
+        if ((dir = ::opendir(path)) == NULL)
+            return;
+
+        while ((entry = ::readdir(dir)) != NULL)
+        {
+            if (::fstatat(::dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode))
+                continue;
+
+            if (now - st.st_mtime > MaxAge)
+            {
+                ::unlinkat(::dirfd(dir), entry->d_name, 0);
+                continue;
+            }
+
+            if (count == capacity)
+            {
+                CacheFile *res = static_cast<CacheFile *>(::realloc(files, (capacity = capacity * 2 + 64) * sizeof(CacheFile)));
+
+                if (UNLIKELY(res == NULL))
+                    break;
+
+                files = res;
+            }
+
+            ::strcpy(files[count].name, entry->d_name);
+            files[count].mTime = st.st_mtime;
+            files[count].size = st.st_size;
+            total += st.st_size;
+            ++count;
+        }
+
+        if (total > MaxCacheSize)
+        {
+            ::qsort(files, count, sizeof(CacheFile), compareAge);
+
+            for (size_t i = 0; i < count && total > MaxCacheSize; ++i)
+                if (::unlinkat(::dirfd(dir), files[i].name, 0) == 0)
+                    total -= files[i].size;
+        }
+
+        ::free(files);
+        ::closedir(dir);
+    }
+}
+
+
+IndexCache::IndexCache(const IEntry *archive) :
+    m_size(0),
+    m_mTime(0),
+    m_mTimeNsec(0),
+    m_fingerprint(0),
+    m_map(MAP_FAILED),
+    m_mapSize(0),
+    m_records(NULL),
+    m_count(0),
+    m_capacity(0),
+    m_strings(NULL),
+    m_stringsSize(0),
+    m_stringsCapacity(0)
+{
+    struct stat st;
+    char dir[sizeof(m_file) - 32];
+    const char *path = archive->location();
+
+    m_file[0] = 0;
+    m_path[0] = 0;
+
+    if (::strcmp(archive->schema(), "file") != 0 || path == NULL || path[0] != '/' ||
+        ::strlen(path) >= sizeof(m_path))
+    {
+        return;
+    }
+
+    if (::stat(path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < MinArchiveSize)
+        return;
+
+    m_size = st.st_size;
+    m_mTime = st.st_mtim.tv_sec;
+    m_mTimeNsec = st.st_mtim.tv_nsec;
+    ::strcpy(m_path, path);
+
+    if (fingerprint(path) && cacheDir(dir, sizeof(dir)))
+        ::snprintf(m_file, sizeof(m_file), "%s/%016llx.idx", dir,
+                   static_cast<unsigned long long>(fnv1a(14695981039346656037ULL, path, ::strlen(path))));
+}
+
+IndexCache::~IndexCache()
+{
+    if (m_map != MAP_FAILED)
+        ::munmap(m_map, m_mapSize);
+    else
+    {
+        ::free(m_records);
+        ::free(m_strings);
+    }
+}
+
+bool IndexCache::load()
+{
+    struct stat st;
+    const Header *header;
+    int fd;
+
+    if (!isValid() || m_map != MAP_FAILED || (fd = ::open(m_file, O_RDONLY | O_CLOEXEC)) == -1)
+        return false;
+
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    m_mapSize = st.st_size;
+    m_map = ::mmap(NULL, m_mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (m_map == MAP_FAILED)
+        return false;
+
+    header = static_cast<const Header *>(m_map);
+
+    if (::memcmp(header->magic, Magic, sizeof(Magic)) == 0 &&
+        header->version == Version &&
+        header->size == m_size &&
+        header->mTime == m_mTime &&
+        header->mTimeNsec == m_mTimeNsec &&
+        header->fingerprint == m_fingerprint &&
+        header->count <= (m_mapSize - sizeof(Header)) / sizeof(Record) &&
+        header->strings == m_mapSize - sizeof(Header) - header->count * sizeof(Record) &&
+        header->location < header->strings)
+    {
+        m_count = header->count;
+        m_records = reinterpret_cast<Record *>(static_cast<char *>(m_map) + sizeof(Header));
+        m_strings = reinterpret_cast<char *>(m_records + m_count);
+        m_stringsSize = header->strings;
+
+        if (m_strings[m_stringsSize - 1] == 0 && ::strcmp(m_strings + header->location, m_path) == 0)
+        {
+            uint32_t i = 0;
+
+            while (i < m_count && m_records[i].path < m_stringsSize)
+                ++i;
+
+            /* Modification time of a listing is when it was used last, see prune(). */
+            if (i == m_count)
+            {
+                ::utimensat(AT_FDCWD, m_file, NULL, 0);
+                return true;
+            }
+        }
+    }
+
+    ::munmap(m_map, m_mapSize);
+    m_map = MAP_FAILED;
+    m_records = NULL;
+    m_strings = NULL;
+    m_count = 0;
+    m_stringsSize = 0;
+    return false;
+}
+
+uint32_t IndexCache::count() const
+{
+    return m_count;
+}
+
+void IndexCache::entry(uint32_t index, Entry &entry) const
+{
+    ASSERT(index < m_count);
+    const Record &record = m_records[index];
+
+    entry.path = m_strings + record.path;
+    entry.size = record.size;
+    entry.offset = record.offset;
+    entry.cTime = record.cTime;
+    entry.mTime = record.mTime;
+    entry.aTime = record.aTime;
+    entry.perm = record.perm;
+}
+
+bool IndexCache::add(const Entry &entry)
+{
+    ASSERT(m_map == MAP_FAILED);
+    size_t len = ::strlen(entry.path) + 1;
+
+    if (!isValid())
+        return false;
+
+    if (m_strings == NULL)
+    {
+        size_t location = ::strlen(m_path) + 1;
+
+        if ((m_strings = static_cast<char *>(::malloc(m_stringsCapacity = 65536))) == NULL)
+        {
+            m_file[0] = 0;
+            return false;
+        }
+
+        ::memcpy(m_strings, m_path, location);
+        m_stringsSize = location;
+    }
+
+    if (m_count == m_capacity)
+    {
+        Record *records = static_cast<Record *>(::realloc(m_records, (m_capacity = m_capacity * 2 + 1024) * sizeof(Record)));
+
+        if (UNLIKELY(records == NULL))
+        {
+            m_file[0] = 0;
+            return false;
+        }
+
+        m_records = records;
+    }
+
+    if (m_stringsSize + len > m_stringsCapacity)
+    {
+        char *strings;
+
+        do
+            m_stringsCapacity *= 2;
+        while (m_stringsSize + len > m_stringsCapacity);
+
+        if (UNLIKELY((strings = static_cast<char *>(::realloc(m_strings, m_stringsCapacity))) == NULL))
+        {
+            m_file[0] = 0;
+            return false;
+        }
+
+        m_strings = strings;
+    }
+
+    Record &record = m_records[m_count++];
+
+    record.path = m_stringsSize;
+    record.size = entry.size;
+    record.offset = entry.offset;
+    record.cTime = entry.cTime;
+    record.mTime = entry.mTime;
+    record.aTime = entry.aTime;
+    record.perm = entry.perm;
+    record.reserved = 0;
+
+    ::memcpy(m_strings + m_stringsSize, entry.path, len);
+    m_stringsSize += len;
+
+    return true;
+}
+
+bool IndexCache::save()
+{
+    ASSERT(m_map == MAP_FAILED);
+    char tmp[sizeof(m_file) + 8];
+    Header header;
+    int res = -1;
+    int fd;
+
+    if (!isValid() || m_strings == NULL)
+        return false;
+
+    ::memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = Version;
+    header.count = m_count;
+    header.size = m_size;
+    header.mTime = m_mTime;
+    header.mTimeNsec = m_mTimeNsec;
+    header.fingerprint = m_fingerprint;
+    header.location = 0;
+    header.strings = m_stringsSize;
+
+    ::snprintf(tmp, sizeof(tmp), "%s.XXXXXX", m_file);
+
+    if ((fd = ::mkstemp(tmp)) == -1)
+        return false;
+
+    if (::write(fd, &header, sizeof(header)) == sizeof(header) &&
+        ::write(fd, m_records, m_count * sizeof(Record)) == static_cast<ssize_t>(m_count * sizeof(Record)) &&
+        ::write(fd, m_strings, m_stringsSize) == static_cast<ssize_t>(m_stringsSize))
+    {
+        res = ::close(fd);
+        fd = -1;
+    }
+
+    if (fd != -1)
+        ::close(fd);
+
+    if (res == 0 && ::rename(tmp, m_file) == 0)
+    {
+        *::strrchr(tmp, '/') = 0;
+        prune(tmp);
+        return true;
+    }
+
+    ::unlink(tmp);
+    return false;
+}
+
+bool IndexCache::fingerprint(const char *path)
+{
+    char buffer[FingerprintSize];
+    ssize_t res;
+    int fd;
+
+    if ((fd = ::open(path, O_RDONLY | O_CLOEXEC)) == -1)
+        return false;
+
+    m_fingerprint = fnv1a(14695981039346656037ULL, &m_size, sizeof(m_size));
+
+    if ((res = ::pread(fd, buffer, sizeof(buffer), 0)) > 0)
+    {
+        m_fingerprint = fnv1a(m_fingerprint, buffer, res);
+
+        if (m_size > FingerprintSize && (res = ::pread(fd, buffer, sizeof(buffer), m_size - FingerprintSize)) > 0)
+            m_fingerprint = fnv1a(m_fingerprint, buffer, res);
+    }
+
+    ::close(fd);
+    return res > 0;
+}
+
+}}
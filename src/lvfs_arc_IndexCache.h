@@ -0,0 +1,104 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LVFS_ARC_INDEXCACHE_H_
+#define LVFS_ARC_INDEXCACHE_H_
+
+#include <lvfs/IEntry>
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+
+
+namespace LVFS {
+namespace Arc {
+
+/**
+ * Persistent listing of an archive.
+ *
+ * Listing is stored in "$XDG_CACHE_HOME/lvfs-arc" and is keyed by the path,
+ * size, modification time and a fingerprint of the head and the tail of the
+ * archive file. Listings unused for 90 days, and the least recently used
+ * ones above 64 MiB in total, are removed on every save. The file consists
+ * of a fixed header, an array of fixed size records and a table of zero
+ * terminated paths, so it can be used directly from mmap(2).
+ */
+class PLATFORM_MAKE_PRIVATE IndexCache
+{
+    PLATFORM_MAKE_NONCOPYABLE(IndexCache)
+
+public:
+    struct Entry
+    {
+        const char *path;
+        int64_t size;
+        int64_t offset;
+        time_t cTime;
+        time_t mTime;
+        time_t aTime;
+        mode_t perm;
+    };
+
+    enum
+    {
+        /* Archives smaller than this are cheaper to scan than to cache. */
+        MinArchiveSize = 1024 * 1024
+    };
+
+public:
+    IndexCache(const IEntry *archive);
+    ~IndexCache();
+
+    bool isValid() const { return m_file[0] != 0; }
+
+    bool load();
+    uint32_t count() const;
+    void entry(uint32_t index, Entry &entry) const;
+
+    bool add(const Entry &entry);
+    bool save();
+
+private:
+    struct Header;
+    struct Record;
+
+    bool fingerprint(const char *path);
+
+private:
+    char m_file[4096];
+    char m_path[4096];
+    int64_t m_size;
+    int64_t m_mTime;
+    int64_t m_mTimeNsec;
+    uint64_t m_fingerprint;
+
+    void *m_map;
+    size_t m_mapSize;
+
+    Record *m_records;
+    uint32_t m_count;
+    uint32_t m_capacity;
+    char *m_strings;
+    uint64_t m_stringsSize;
+    uint64_t m_stringsCapacity;
+};
+
+}}
+
+#endif /* LVFS_ARC_INDEXCACHE_H_ */
@@ -25,7 +25,9 @@ namespace LVFS {
 namespace Arc {
 namespace LibArchive {
 
-Plugin::Plugin()
+Plugin::Plugin(int formats, int filters) :
+    m_formats(formats),
+    m_filters(filters)
 {}
 
 Plugin::~Plugin()
@@ -33,7 +35,7 @@ Plugin::~Plugin()
 
 Interface::Holder Plugin::open(const Interface::Holder &file) const
 {
-    return Interface::Holder(new (std::nothrow) Archive(file));
+    return Interface::Holder(new (std::nothrow) Archive(file, m_formats, m_filters));
 }
 
 const Error &Plugin::lastError() const
@@ -27,6 +27,28 @@ namespace LVFS {
 namespace Arc {
 namespace LibArchive {
 
+/* Formats and filters bidding for a type, none of them means all. */
+enum Format
+{
+    Tar      = 1 << 0,
+    Zip      = 1 << 1,
+    SevenZip = 1 << 2,
+    Ar       = 1 << 3,
+    Cpio     = 1 << 4,
+    Iso9660  = 1 << 5
+};
+
+enum Filter
+{
+    Gzip     = 1 << 0,
+    Bzip2    = 1 << 1,
+    Xz       = 1 << 2,
+    Lzma     = 1 << 3,
+    Compress = 1 << 4,
+    Rpm      = 1 << 5
+};
+
+
 class PLATFORM_MAKE_PRIVATE Plugin : public Implements<IContentPlugin>
 {
     PLATFORM_MAKE_NONCOPYABLE(Plugin)
@@ -34,7 +56,7 @@ class PLATFORM_MAKE_PRIVATE Plugin : public Implements<IContentPlugin>
     PLATFORM_MAKE_STACK_ONLY
 
 public:
-    Plugin();
+    Plugin(int formats = 0, int filters = 0);
     virtual ~Plugin();
 
     virtual Interface::Holder open(const Interface::Holder &file) const;
@@ -43,6 +65,8 @@ public:
     virtual void registered();
 
 private:
+    int m_formats;
+    int m_filters;
     Error m_error;
 };
 
@@ -0,0 +1,394 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lvfs_arc_Listing.h"
+
+#include <brolly/assert.h>
+
+#include <cstdlib>
+#include <cstring>
+
+
+namespace LVFS {
+namespace Arc {
+
+namespace {
+    enum
+    {
+        MinRecords = 1024,
+        MinStrings = 64 * 1024,
+        MinTable = 1024,
+        MaxStrings = 0xFFFFFFF0
+    };
+
+    inline uint32_t fnv1a(uint32_t hash, const char *data, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619U;
+
+        return hash;
+    }
+
+    inline uint32_t hashName(const char *name, size_t size)
+    {
+        return fnv1a(2166136261U, name, size);
+    }
+}
+
+
+Listing::Listing() :
+    m_records(NULL),
+    m_count(0),
+    m_capacity(0),
+    m_hashes(NULL),
+    m_strings(NULL),
+    m_stringsSize(0),
+    m_stringsCapacity(0),
+    m_names(NULL),
+    m_namesCount(0),
+    m_namesCapacity(0),
+    m_paths(NULL),
+    m_pathsCapacity(0)
+{
+    uint32_t name = intern("", 0);
+
+    /* Without the root every add() fails. */
+    if (LIKELY(name != None))
+        append(None, name, None);
+}
+
+Listing::~Listing()
+{
+    ::free(m_records);
+    ::free(m_hashes);
+    ::free(m_strings);
+    ::free(m_names);
+    ::free(m_paths);
+}
+
+bool Listing::add(const char *path, uint32_t index, int64_t size, int64_t offset,
+                  time_t cTime, time_t mTime, time_t aTime, mode_t perm, uint32_t *added)
+{
+    uint32_t parent = Root;
+    uint32_t record;
+    uint32_t name;
+    const char *sep;
+
+    if (added)
+        *added = None;
+
+    if (UNLIKELY(m_count == 0))
+        return false;
+
+    for (; (sep = ::strchr(path, '/')) != NULL; path = sep + 1)
+    {
+        if (UNLIKELY((name = intern(path, sep - path)) == None))
+            return false;
+
+        if ((record = child(parent, name)) == None)
+        {
+            if (UNLIKELY((record = append(parent, name, None)) == None))
+                return false;
+        }
+        else if (!isDir(record))
+            return true;
+
+        parent = record;
+    }
+
+    if (UNLIKELY((name = intern(path, ::strlen(path))) == None))
+        return false;
+
+    /* The first of members with the same path wins. */
+    if (child(parent, name) != None)
+        return true;
+
+    if (UNLIKELY((record = append(parent, name, index)) == None))
+        return false;
+
+    Record &res = m_records[record];
+
+    res.perm = perm;
+    res.size = size;
+    res.offset = offset;
+    res.cTime = cTime;
+    res.mTime = mTime;
+    res.aTime = aTime;
+
+    if (added)
+        *added = record;
+
+    return true;
+}
+
+char *Listing::path(uint32_t record) const
+{
+    size_t size = 0;
+    size_t len;
+    char *res;
+
+    for (uint32_t i = record; i != Root; i = m_records[i].parent)
+        size += ::strlen(name(i)) + 1;
+
+    if (UNLIKELY(size == 0 || (res = static_cast<char *>(::malloc(size))) == NULL))
+        return NULL;
+
+    res[--size] = 0;
+
+    for (uint32_t i = record; i != Root; i = m_records[i].parent)
+    {
+        len = ::strlen(name(i));
+        size -= len;
+        ::memcpy(res + size, name(i), len);
+
+        if (size > 0)
+            res[--size] = '/';
+    }
+
+    return res;
+}
+
+uint32_t Listing::find(const char *path, uint32_t base) const
+{
+    size_t size = ::strlen(path);
+    uint32_t mask = m_pathsCapacity - 1;
+    uint32_t key;
+
+    while (size > 0 && path[size - 1] == '/')
+        --size;
+
+    if (size == 0)
+        return base < m_count ? base : None;
+
+    if (m_pathsCapacity == 0)
+        return None;
+
+    key = hash(base, path, size);
+
+    for (uint32_t i = key & mask; m_paths[i] != None; i = (i + 1) & mask)
+        if (m_hashes[m_paths[i]] == key && matches(m_paths[i], base, path, size))
+            return m_paths[i];
+
+    return None;
+}
+
+uint32_t Listing::lookup(const char *name, size_t size, uint32_t &slot) const
+{
+    uint32_t mask = m_namesCapacity - 1;
+
+    if (m_namesCapacity == 0)
+        return None;
+
+    for (slot = hashName(name, size) & mask; m_names[slot] != None; slot = (slot + 1) & mask)
+        if (::strncmp(m_strings + m_names[slot], name, size) == 0 && m_strings[m_names[slot] + size] == 0)
+            return m_names[slot];
+
+    return None;
+}
+
+uint32_t Listing::intern(const char *name, size_t size)
+{
+    uint32_t slot;
+    uint32_t res;
+
+    if ((res = lookup(name, size, slot)) != None)
+        return res;
+
+    if ((m_namesCount + 1) * 2 > m_namesCapacity)
+    {
+        if (UNLIKELY(!rehash(m_names, m_namesCapacity, true)))
+            return None;
+
+        lookup(name, size, slot);
+    }
+
+    if (m_stringsSize + size + 1 > m_stringsCapacity)
+    {
+        uint64_t capacity = m_stringsCapacity ? static_cast<uint64_t>(m_stringsCapacity) * 2 : MinStrings;
+        char *strings;
+
+        while (capacity < m_stringsSize + size + 1)
+            capacity *= 2;
+
+        if (UNLIKELY(capacity > MaxStrings || (strings = static_cast<char *>(::realloc(m_strings, capacity))) == NULL))
+            return None;
+
+        m_strings = strings;
+        m_stringsCapacity = capacity;
+    }
+
+    res = m_stringsSize;
+    ::memcpy(m_strings + res, name, size);
+    m_strings[res + size] = 0;
+    m_stringsSize += size + 1;
+
+    m_names[slot] = res;
+    ++m_namesCount;
+
+    return res;
+}
+
+uint32_t Listing::child(uint32_t parent, uint32_t name) const
+{
+    uint32_t mask = m_pathsCapacity - 1;
+    uint32_t key;
+
+    if (m_pathsCapacity == 0)
+        return None;
+
+    key = hash(parent, m_strings + name, ::strlen(m_strings + name));
+
+    for (uint32_t i = key & mask; m_paths[i] != None; i = (i + 1) & mask)
+        if (m_records[m_paths[i]].parent == parent && m_records[m_paths[i]].name == name)
+            return m_paths[i];
+
+    return None;
+}
+
+uint32_t Listing::hash(uint32_t parent, const char *path, size_t size) const
+{
+    uint32_t res = m_hashes[parent];
+
+    /* Hash of a path continues the hash of its parent directory. */
+    if (parent != Root)
+        res = fnv1a(res, "/", 1);
+
+    return fnv1a(res, path, size);
+}
+
+bool Listing::matches(uint32_t record, uint32_t base, const char *path, size_t size) const
+{
+    size_t len;
+
+    for (; record != base; record = m_records[record].parent)
+    {
+        if (record == Root)
+            return false;
+
+        len = ::strlen(name(record));
+
+        if (len > size || ::memcmp(path + size - len, name(record), len) != 0)
+            return false;
+
+        size -= len;
+
+        if (m_records[record].parent != base)
+            if (size == 0 || path[--size] != '/')
+                return false;
+    }
+
+    return size == 0;
+}
+
+uint32_t Listing::append(uint32_t parent, uint32_t name, uint32_t index)
+{
+    uint32_t res = m_count;
+
+    if (UNLIKELY(res == None - 1))
+        return None;
+
+    if (m_count == m_capacity)
+    {
+        uint32_t capacity = m_capacity ? m_capacity * 2 : MinRecords;
+        Record *records;
+        uint32_t *hashes;
+
+        if (UNLIKELY(capacity < m_capacity || (records = static_cast<Record *>(::realloc(m_records, static_cast<size_t>(capacity) * sizeof(Record)))) == NULL))
+            return None;
+
+        m_records = records;
+
+        if (UNLIKELY((hashes = static_cast<uint32_t *>(::realloc(m_hashes, static_cast<size_t>(capacity) * sizeof(uint32_t)))) == NULL))
+            return None;
+
+        m_hashes = hashes;
+        m_capacity = capacity;
+    }
+
+    if (m_count * 2 >= m_pathsCapacity && UNLIKELY(!rehash(m_paths, m_pathsCapacity, false)))
+        return None;
+
+    Record &record = m_records[res];
+
+    ::memset(&record, 0, sizeof(record));
+    record.name = name;
+    record.parent = parent;
+    record.child = None;
+    record.sibling = None;
+    record.index = index;
+
+    if (parent == None)
+        m_hashes[res] = hashName("", 0);
+    else
+        m_hashes[res] = hash(parent, m_strings + name, ::strlen(m_strings + name));
+
+    ++m_count;
+
+    if (parent != None)
+    {
+        uint32_t mask = m_pathsCapacity - 1;
+        uint32_t i;
+
+        record.sibling = m_records[parent].child;
+        m_records[parent].child = res;
+
+        for (i = m_hashes[res] & mask; m_paths[i] != None; i = (i + 1) & mask)
+            ;
+
+        m_paths[i] = res;
+    }
+
+    return res;
+}
+
+bool Listing::rehash(uint32_t *&table, uint32_t &capacity, bool names)
+{
+    uint32_t size = capacity ? capacity * 2 : MinTable;
+    uint32_t mask = size - 1;
+    uint32_t *res;
+    uint32_t hash;
+    uint32_t j;
+
+    if (UNLIKELY(size < capacity || (res = static_cast<uint32_t *>(::malloc(static_cast<size_t>(size) * sizeof(uint32_t)))) == NULL))
+        return false;
+
+    ::memset(res, 0xFF, static_cast<size_t>(size) * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < capacity; ++i)
+        if (table[i] != None)
+        {
+            if (names)
+                hash = hashName(m_strings + table[i], ::strlen(m_strings + table[i]));
+            else
+                hash = m_hashes[table[i]];
+
+            for (j = hash & mask; res[j] != None; j = (j + 1) & mask)
+                ;
+
+            res[j] = table[i];
+        }
+
+    ::free(table);
+    table = res;
+    capacity = size;
+
+    return true;
+}
+
+}}
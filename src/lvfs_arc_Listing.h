@@ -0,0 +1,118 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LVFS_ARC_LISTING_H_
+#define LVFS_ARC_LISTING_H_
+
+#include <efc/Holder>
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+
+
+namespace LVFS {
+namespace Arc {
+
+/**
+ * Compact tree of archive members.
+ *
+ * Every file and directory is a fixed size record in one array, names of
+ * path components are interned in one string table. Records of a directory
+ * are chained through "sibling" starting from its "child". IEntry objects
+ * are made from records only when a directory is iterated.
+ *
+ * Records are indexed by the hash of their full path, so both a member of
+ * a directory and a deep path are found without walking the tree.
+ */
+class PLATFORM_MAKE_PRIVATE Listing : public ::EFC::Holder<Listing>::Data
+{
+    PLATFORM_MAKE_NONCOPYABLE(Listing)
+
+public:
+    typedef ::EFC::Holder<Listing> Holder;
+
+    enum
+    {
+        Root = 0,
+        None = 0xFFFFFFFF
+    };
+
+    struct Record
+    {
+        uint32_t name;
+        uint32_t parent;
+        uint32_t child;
+        uint32_t sibling;
+        uint32_t index;
+        uint32_t perm;
+        int64_t size;
+        int64_t offset;
+        int64_t cTime;
+        int64_t mTime;
+        int64_t aTime;
+    };
+
+public:
+    Listing();
+    virtual ~Listing();
+
+    bool add(const char *path, uint32_t index, int64_t size, int64_t offset,
+             time_t cTime, time_t mTime, time_t aTime, mode_t perm, uint32_t *record = NULL);
+
+    inline uint32_t count() const { return m_count; }
+    inline const Record &record(uint32_t record) const { return m_records[record]; }
+    inline bool isDir(uint32_t record) const { return m_records[record].index == None; }
+    inline const char *name(uint32_t record) const { return m_strings + m_records[record].name; }
+    inline uint32_t first(uint32_t dir) const { return dir < m_count ? m_records[dir].child : None; }
+
+    char *path(uint32_t record) const;
+    uint32_t find(const char *path, uint32_t base = Root) const;
+
+private:
+    uint32_t lookup(const char *name, size_t size, uint32_t &slot) const;
+    uint32_t intern(const char *name, size_t size);
+    uint32_t child(uint32_t parent, uint32_t name) const;
+    uint32_t hash(uint32_t parent, const char *path, size_t size) const;
+    bool matches(uint32_t record, uint32_t base, const char *path, size_t size) const;
+    uint32_t append(uint32_t parent, uint32_t name, uint32_t index);
+    bool rehash(uint32_t *&table, uint32_t &capacity, bool names);
+
+private:
+    Record *m_records;
+    uint32_t m_count;
+    uint32_t m_capacity;
+
+    /* Full path hashes of records, kept apart to leave records at 64 bytes. */
+    uint32_t *m_hashes;
+
+    char *m_strings;
+    uint32_t m_stringsSize;
+    uint32_t m_stringsCapacity;
+
+    uint32_t *m_names;
+    uint32_t m_namesCount;
+    uint32_t m_namesCapacity;
+
+    uint32_t *m_paths;
+    uint32_t m_pathsCapacity;
+};
+
+}}
+
+#endif /* LVFS_ARC_LISTING_H_ */
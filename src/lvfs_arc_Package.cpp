@@ -45,31 +45,43 @@ Settings::Scope *Package::settings() const
 
 const Package::Plugin **Package::contentPlugins() const
 {
+    /* Modules of libarchive bidding for each type, other types get all of them. */
     static const LibArchive::Plugin libArchive;
+    static const LibArchive::Plugin tar(LibArchive::Tar);
+    static const LibArchive::Plugin tarGzip(LibArchive::Tar, LibArchive::Gzip);
+    static const LibArchive::Plugin tarBzip2(LibArchive::Tar, LibArchive::Bzip2);
+    static const LibArchive::Plugin tarXz(LibArchive::Tar, LibArchive::Xz);
+    static const LibArchive::Plugin tarLzma(LibArchive::Tar, LibArchive::Lzma);
+    static const LibArchive::Plugin tarCompress(LibArchive::Tar, LibArchive::Compress);
+    static const LibArchive::Plugin zip(LibArchive::Zip);
+    static const LibArchive::Plugin sevenZip(LibArchive::SevenZip);
+    static const LibArchive::Plugin ar(LibArchive::Ar);
+    static const LibArchive::Plugin rpm(LibArchive::Cpio, LibArchive::Rpm | LibArchive::Gzip | LibArchive::Bzip2 | LibArchive::Xz | LibArchive::Lzma);
+    static const LibArchive::Plugin iso9660(LibArchive::Iso9660);
     static const LibUnrar::Plugin libUnrar;
 
     static const Plugin types[] =
     {
-        { "application/x-gzip",                libArchive },
-        { "application/x-tar",                 libArchive },
-        { "application/x-compressed-tar",      libArchive },
-        { "application/x-bzip-compressed-tar", libArchive },
-        { "application/zip",                   libArchive },
-        { "application/x-bzip",                libArchive },
-        { "application/x-tarz",                libArchive },
-        { "application/x-bzip2",               libArchive },
-        { "application/x-java-archive",        libArchive },
-        { "application/x-deb",                 libArchive },
-        { "application/x-rpm",                 libArchive },
-        { "application/x-7z-compressed",       libArchive },
-        { "application/x-compress",            libArchive },
-        { "application/x-zip-compressed",      libArchive },
-        { "application/x-lzma",                libArchive },
-        { "application/x-servicepack",         libArchive },
-        { "application/x-xz-compressed-tar",   libArchive },
-        { "application/x-lzma-compressed-tar", libArchive },
-        { "application/x-cd-image",            libArchive },
-        { "application/x-rar",                 libUnrar   }
+        { "application/x-gzip",                tarGzip     },
+        { "application/x-tar",                 tar         },
+        { "application/x-compressed-tar",      tarGzip     },
+        { "application/x-bzip-compressed-tar", tarBzip2    },
+        { "application/zip",                   zip         },
+        { "application/x-bzip",                tarBzip2    },
+        { "application/x-tarz",                tarCompress },
+        { "application/x-bzip2",               tarBzip2    },
+        { "application/x-java-archive",        zip         },
+        { "application/x-deb",                 ar          },
+        { "application/x-rpm",                 rpm         },
+        { "application/x-7z-compressed",       sevenZip    },
+        { "application/x-compress",            tarCompress },
+        { "application/x-zip-compressed",      zip         },
+        { "application/x-lzma",                tarLzma     },
+        { "application/x-servicepack",         libArchive  },
+        { "application/x-xz-compressed-tar",   tarXz       },
+        { "application/x-lzma-compressed-tar", tarLzma     },
+        { "application/x-cd-image",            iso9660     },
+        { "application/x-rar",                 libUnrar    }
     };
     enum { Count = sizeof(types) / sizeof(Plugin) };
 
@@ -0,0 +1,256 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lvfs_arc_ScanPool.h"
+
+#include <brolly/assert.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+
+namespace LVFS {
+namespace Arc {
+
+namespace {
+    struct Worker
+    {
+        ScanPool *pool;
+        uint32_t index;
+    };
+}
+
+
+ScanPool::Task::Task() :
+    m_prev(NULL),
+    m_next(NULL),
+    m_queue(None)
+{}
+
+ScanPool::Task::~Task()
+{}
+
+
+ScanPool::ScanPool() :
+    m_workers(1),
+    m_started(0),
+    m_next(0),
+    m_pending(0),
+    m_running(0),
+    m_limit(0)
+{
+    long cpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+    const char *value = ::getenv("LVFS_ARC_SCAN_IO");
+
+    if (cpus > 1)
+        m_workers = cpus < MaxWorkers ? cpus : MaxWorkers;
+
+    if (value != NULL && *value != 0)
+        m_limit = ::strtoul(value, NULL, 10);
+
+    if (m_limit == 0 || m_limit > m_workers)
+        m_limit = m_workers;
+
+    ::memset(m_queues, 0, sizeof(m_queues));
+    ::pthread_mutex_init(&m_mutex, NULL);
+    ::pthread_cond_init(&m_cond, NULL);
+}
+
+ScanPool::~ScanPool()
+{
+    ::pthread_cond_destroy(&m_cond);
+    ::pthread_mutex_destroy(&m_mutex);
+}
+
+ScanPool &ScanPool::instance()
+{
+    /* Workers are detached and never stop, so is the pool. */
+    static ScanPool *pool = new ScanPool();
+    return *pool;
+}
+
+bool ScanPool::submit(Task *task)
+{
+    Queue *queue;
+
+    ASSERT(task->m_queue == None);
+    ::pthread_mutex_lock(&m_mutex);
+
+    if (UNLIKELY(!start()))
+    {
+        ::pthread_mutex_unlock(&m_mutex);
+        return false;
+    }
+
+    task->m_queue = m_next++ % m_started;
+    queue = &m_queues[task->m_queue];
+
+    task->m_next = NULL;
+    task->m_prev = queue->tail;
+
+    if (queue->tail)
+        queue->tail->m_next = task;
+    else
+        queue->head = task;
+
+    queue->tail = task;
+    ++m_pending;
+
+    ::pthread_cond_broadcast(&m_cond);
+    ::pthread_mutex_unlock(&m_mutex);
+
+    return true;
+}
+
+bool ScanPool::cancel(Task *task)
+{
+    bool res = false;
+
+    ::pthread_mutex_lock(&m_mutex);
+
+    if (task->m_queue != None)
+    {
+        Queue &queue = m_queues[task->m_queue];
+
+        if (task->m_prev)
+            task->m_prev->m_next = task->m_next;
+        else
+            queue.head = task->m_next;
+
+        if (task->m_next)
+            task->m_next->m_prev = task->m_prev;
+        else
+            queue.tail = task->m_prev;
+
+        task->m_queue = None;
+        --m_pending;
+        res = true;
+    }
+
+    ::pthread_mutex_unlock(&m_mutex);
+    return res;
+}
+
+void *ScanPool::worker(void *arg)
+{
+    Worker *self = static_cast<Worker *>(arg);
+    ScanPool *pool = self->pool;
+    uint32_t index = self->index;
+    Task *task;
+
+    delete self;
+    ::pthread_mutex_lock(&pool->m_mutex);
+
+    for (;;)
+    {
+        while (pool->m_pending == 0 || pool->m_running >= pool->m_limit)
+            ::pthread_cond_wait(&pool->m_cond, &pool->m_mutex);
+
+        task = pool->take(index);
+        ++pool->m_running;
+        ::pthread_mutex_unlock(&pool->m_mutex);
+
+        task->run();
+        delete task;
+
+        ::pthread_mutex_lock(&pool->m_mutex);
+        --pool->m_running;
+        ::pthread_cond_broadcast(&pool->m_cond);
+    }
+
+    return NULL;
+}
+
+ScanPool::Task *ScanPool::take(uint32_t worker)
+{
+    Queue *queue = &m_queues[worker];
+    Task *res;
+
+    ASSERT(m_pending > 0);
+
+    if ((res = queue->head) != NULL)
+    {
+        if ((queue->head = res->m_next) != NULL)
+            queue->head->m_prev = NULL;
+        else
+            queue->tail = NULL;
+    }
+    else
+    {
+        /* Steal the most recently queued task of another worker. */
+        for (uint32_t i = 1; res == NULL; ++i)
+            if ((res = m_queues[(worker + i) % m_started].tail) != NULL)
+            {
+                queue = &m_queues[(worker + i) % m_started];
+
+                if ((queue->tail = res->m_prev) != NULL)
+                    queue->tail->m_next = NULL;
+                else
+                    queue->head = NULL;
+            }
+    }
+
+    res->m_prev = NULL;
+    res->m_next = NULL;
+    res->m_queue = None;
+    --m_pending;
+
+    return res;
+}
+
+bool ScanPool::start()
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    Worker *worker;
+
+    if (m_started == m_workers)
+        return m_started > 0;
+
+    ::pthread_attr_init(&attr);
+    ::pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    for (; m_started < m_workers; ++m_started)
+    {
+        if (UNLIKELY((worker = new (std::nothrow) Worker) == NULL))
+            break;
+
+        worker->pool = this;
+        worker->index = m_started;
+
+        if (::pthread_create(&thread, &attr, ScanPool::worker, worker) != 0)
+        {
+            delete worker;
+            break;
+        }
+    }
+
+    ::pthread_attr_destroy(&attr);
+
+    /* Fewer workers are still fine, none is not. */
+    m_workers = m_started;
+
+    if (m_limit > m_workers)
+        m_limit = m_workers;
+
+    return m_started > 0;
+}
+
+}}
@@ -0,0 +1,101 @@
+/**
+ * This file is part of lvfs-arc.
+ *
+ * Copyright (C) 2011-2014 Dmitriy Vilkov, <dav.daemon@gmail.com>
+ *
+ * lvfs-arc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lvfs-arc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lvfs-arc. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LVFS_ARC_SCANPOOL_H_
+#define LVFS_ARC_SCANPOOL_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+
+namespace LVFS {
+namespace Arc {
+
+/**
+ * Process-wide pool of threads scanning archives.
+ *
+ * Every worker has its own queue and takes tasks from its front, idle
+ * workers steal from the back of other queues. Tasks are whole scans, so
+ * one lock guards all queues. Number of workers follows the number of
+ * online CPUs, number of scans running at once (and so doing I/O) is
+ * limited by LVFS_ARC_SCAN_IO.
+ */
+class PLATFORM_MAKE_PRIVATE ScanPool
+{
+    PLATFORM_MAKE_NONCOPYABLE(ScanPool)
+
+public:
+    class Task
+    {
+        PLATFORM_MAKE_NONCOPYABLE(Task)
+
+    public:
+        Task();
+        virtual ~Task();
+
+        virtual void run() = 0;
+
+    private:
+        friend class ScanPool;
+        Task *m_prev;
+        Task *m_next;
+        uint32_t m_queue;
+    };
+
+    enum
+    {
+        MaxWorkers = 64,
+        None = 0xFFFFFFFF
+    };
+
+public:
+    static ScanPool &instance();
+
+    bool submit(Task *task);
+    bool cancel(Task *task);
+
+private:
+    ScanPool();
+    ~ScanPool();
+
+    static void *worker(void *arg);
+    Task *take(uint32_t worker);
+    bool start();
+
+private:
+    struct Queue
+    {
+        Task *head;
+        Task *tail;
+    };
+
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+    Queue m_queues[MaxWorkers];
+    uint32_t m_workers;
+    uint32_t m_started;
+    uint32_t m_next;
+    uint32_t m_pending;
+    uint32_t m_running;
+    uint32_t m_limit;
+};
+
+}}
+
+#endif /* LVFS_ARC_SCANPOOL_H_ */